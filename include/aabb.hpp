@@ -0,0 +1,77 @@
+#ifndef AABB_HPP
+#define AABB_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <limits>
+
+class Aabb {
+public:
+    Aabb() noexcept
+        : min(std::numeric_limits<float>::infinity()),
+          max(-std::numeric_limits<float>::infinity()) {};
+    Aabb(glm::vec3 min, glm::vec3 max) noexcept : min(min), max(max) {};
+
+    inline bool empty() const noexcept {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    inline void grow(const glm::vec3 point) noexcept {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    inline void grow(const Aabb& other) noexcept {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    inline glm::vec3 centroid() const noexcept { return (min + max) * 0.5f; }
+    inline glm::vec3 extent() const noexcept { return max - min; }
+
+    inline float surface_area() const noexcept {
+        if (empty()) {
+            return 0.0f;
+        }
+
+        glm::vec3 e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    inline bool overlaps(const Aabb& other) const noexcept {
+        return min.x < other.max.x && other.min.x < max.x &&
+               min.y < other.max.y && other.min.y < max.y &&
+               min.z < other.max.z && other.min.z < max.z;
+    }
+
+    inline bool contains(const Aabb& other) const noexcept {
+        return min.x <= other.min.x && other.max.x <= max.x &&
+               min.y <= other.min.y && other.max.y <= max.y &&
+               min.z <= other.min.z && other.max.z <= max.z;
+    }
+
+    bool operator==(const Aabb& other) const = default;
+
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// World space bounds of a box after an affine transform (Arvo's method)
+inline Aabb transform_aabb(const Aabb& box, const glm::mat4& transform) {
+    Aabb result{glm::vec3(transform[3]), glm::vec3(transform[3])};
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            float a = transform[j][i] * box.min[j];
+            float b = transform[j][i] * box.max[j];
+
+            result.min[i] += std::min(a, b);
+            result.max[i] += std::max(a, b);
+        }
+    }
+
+    return result;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <glm/glm.hpp>
+
+#include <entt/entt.hpp>
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+// Command line of voxel-engine. Without --headless everything but the size
+// is ignored and the engine runs interactively.
+typedef struct BenchmarkOptions {
+    bool headless = false;
+    bool surfaceless = false; // No display at all, needs GLFW 3.4 and EGL
+    int width = 1920;
+    int height = 1080;
+    int frames = 300;
+    int warmup_frames = 16;
+    int capture_every = 0; // 0 only captures the last frame
+    float frame_time = 1.0f / 60.0f; // Of the scripted clock, in seconds
+    float seed = 1.0f;
+    std::filesystem::path camera_path;
+    std::filesystem::path timeline;
+    std::filesystem::path output_dir = "results";
+} BenchmarkOptions;
+
+// Throws std::runtime_error on unknown or malformed arguments
+BenchmarkOptions parse_options(std::span<char* const> args);
+
+std::string usage();
+
+typedef struct CameraKey {
+    float time;
+    glm::vec3 pos;
+    float pitch;
+    float yaw;
+} CameraKey;
+
+// Keys are interpolated linearly and held before the first and after the
+// last one
+class CameraPath {
+public:
+    CameraPath() noexcept = default;
+    explicit CameraPath(std::vector<CameraKey> keys);
+
+    // CSV of time,x,y,z,pitch,yaw
+    static CameraPath load(const std::filesystem::path& path);
+
+    inline bool empty() const noexcept { return keys.empty(); }
+    CameraKey at(float time) const;
+
+private:
+    std::vector<CameraKey> keys;
+};
+
+typedef struct TransformKey {
+    float time;
+    size_t instance; // Index into the instances given to apply()
+    glm::vec3 translation;
+    glm::vec3 rotation; // Euler angles in radians, applied as yaw pitch roll
+    glm::vec3 scale;
+} TransformKey;
+
+// Scripted Transformable of some of the instances of a scene, interpolated
+// like CameraPath per instance
+class TransformTimeline {
+public:
+    TransformTimeline() noexcept = default;
+    explicit TransformTimeline(std::vector<TransformKey> keys);
+
+    // CSV of time,instance,tx,ty,tz,rx,ry,rz,sx,sy,sz
+    static TransformTimeline load(const std::filesystem::path& path);
+
+    inline bool empty() const noexcept { return keys.empty(); }
+    glm::mat4 at(size_t instance, float time) const;
+
+    // Instances without keys keep their transform
+    void apply(
+        float time, std::span<const entt::entity> instances,
+        entt::registry& registry
+    ) const;
+
+private:
+    std::vector<TransformKey> keys; // Sorted by instance, then time
+};
+
+#endif
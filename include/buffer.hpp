@@ -189,7 +189,16 @@ public:
         return cpu_buffer.size() - 1;
     }
 
+    // Moves the elements after the removed ones down, on the GPU with the
+    // next upload()
+    void erase(size_t first, size_t count) {
+        cpu_buffer.erase(
+            cpu_buffer.begin() + first, cpu_buffer.begin() + first + count
+        );
+    }
+
     size_t size() { return cpu_buffer.size(); }
+    std::span<const T> cpu_data() const noexcept { return cpu_buffer; }
 
     void upload() {
         gl::glNamedBufferSubData(
@@ -0,0 +1,61 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include "aabb.hpp"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Matches `BvhNode` in common.comp (std430). Interior nodes have count == 0
+// and their children are stored next to each other at left_first and
+// left_first + 1. Leaves reference `count` instances starting at left_first
+// in the index list.
+typedef struct alignas(16) BvhNode {
+    alignas(16) glm::vec3 aabb_min;
+    alignas(4) uint32_t left_first;
+    alignas(16) glm::vec3 aabb_max;
+    alignas(4) uint32_t count;
+} BvhNode;
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode must match the std430 layout");
+
+class InstanceBvh {
+public:
+    InstanceBvh() noexcept;
+
+    // Rebuilds the tree if the instance count changed or the refitted tree
+    // has degraded too much, refits it if only the bounds changed, and does
+    // nothing otherwise. Returns true if the node list changed.
+    bool update(std::span<const Aabb> bounds);
+
+    void build(std::span<const Aabb> bounds);
+    void refit(std::span<const Aabb> bounds);
+
+    inline const std::vector<BvhNode>& get_nodes() const noexcept {
+        return nodes;
+    }
+    inline const std::vector<uint32_t>& get_indices() const noexcept {
+        return indices;
+    }
+
+    // Sum of node surface areas relative to the root; grows as refitting
+    // makes siblings overlap.
+    float cost() const noexcept;
+
+private:
+    void subdivide(uint32_t node_index, uint32_t depth);
+    Aabb node_bounds(uint32_t first, uint32_t count) const noexcept;
+
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> indices;
+    std::vector<Aabb> prim_bounds;
+
+    std::atomic<uint32_t> nodes_used;
+    float built_cost;
+};
+
+#endif
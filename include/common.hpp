@@ -3,10 +3,13 @@
 
 #define DAG
 
+#include <cmath>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <span>
 #include <string>
 #include <type_traits>
 #include <utility>
@@ -50,6 +53,50 @@ load_image(const std::filesystem::path& path, int desired_channels = 4) {
     return {image, width, height};
 }
 
+// Same as above, but decodes an image that is already in memory
+inline std::tuple<std::vector<std::byte>, int, int>
+load_image(std::span<const std::byte> encoded, int desired_channels = 4) {
+    int width, height, channels;
+    std::byte* data = (std::byte*)stbi_load_from_memory(
+        (const stbi_uc*)encoded.data(), encoded.size(), &width, &height,
+        &channels, desired_channels
+    );
+
+    if (data == NULL) {
+        throw std::runtime_error(
+            std::format("Could not decode the image, {}", stbi_failure_reason())
+        );
+    }
+
+    std::vector<std::byte> image{
+        data, data + width * height * desired_channels
+    };
+
+    stbi_image_free(data);
+
+    return {image, width, height};
+}
+
+// 64 bit FNV-1a. Keys the on-disk caches, so it must stay stable.
+inline uint64_t
+fnv1a(std::span<const std::byte> data, uint64_t hash = 0xcbf29ce484222325) {
+    for (std::byte byte : data) {
+        hash ^= uint64_t(byte);
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+inline float srgb_to_linear(float c) {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linear_to_srgb(float c) {
+    return c <= 0.0031308f ? c * 12.92f
+                           : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
 template <auto V> struct value_wrapper {
     static constexpr auto value = V;
 };
@@ -0,0 +1,120 @@
+#ifndef CPU_RAYMARCH_HPP
+#define CPU_RAYMARCH_HPP
+
+#include "svodag.hpp"
+#include "thread_pool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <utility>
+
+inline std::pair<float, float> slab_test(
+    const glm::vec3 cor1, const glm::vec3 cor2, const glm::vec3 pos,
+    const glm::vec3 dir_inv
+) {
+    using std::min, std::max;
+
+    // https://tavianator.com/2015/ray_box_nan.html
+    glm::vec3 t1 = (cor1 - pos) * dir_inv;
+    glm::vec3 t2 = (cor2 - pos) * dir_inv;
+
+    float tmin = min(t1.x, t2.x);
+    float tmax = max(t1.x, t2.x);
+
+    // Eliminates NaN problem
+    tmin = max(tmin, min(min(t1.y, t2.y), tmax));
+    tmax = min(tmax, max(max(t1.y, t2.y), tmin));
+
+    tmin = max(tmin, min(min(t1.z, t2.z), tmax));
+    tmax = min(tmax, max(max(t1.z, t2.z), tmin));
+
+    return std::make_pair(tmin, tmax);
+}
+
+typedef struct {
+    glm::vec3 pos; // Where the ray entered the voxel, in model space
+    MatID_t mat_id;
+} CpuHit;
+
+// Reference traversal on the CPU, walking SvoDag::query() from voxel to voxel.
+// The tree spans (0, 0, 0) ~ (1, 1, 1).
+std::optional<CpuHit> trace(const SvoDag& svodag, const Ray ray);
+
+// Color of the first solid voxel, or transparent black on a miss
+glm::vec4 raymarch(const SvoDag& svodag, const Ray ray);
+
+// Must match MAX_ITERS in common.comp
+const uint32_t flat_max_iters = 100;
+
+typedef struct {
+    bool hit;
+    glm::vec3 pos;    // Model space, on the face the ray entered through
+    glm::vec3 normal; // Model space, of that face
+    uint32_t at_level;
+    MatID_t mat_id;
+    uint32_t steps; // Including the one that hit
+} FlatTraceResult;
+
+// Same walk as trace_instance() and raymarch_model() in common.comp, over the
+// output of SvoDag::serialize() with the root at index 0. Follows the shader
+// operation by operation in single precision, with min() and max() as GPUs
+// implement them, so that it can serve as an oracle for the GPU traversal.
+// Neither allocates nor touches refcounts. `dir` must be normalized.
+FlatTraceResult trace_flat(
+    std::span<const SerializedNode> nodes, uint32_t level, const Ray ray,
+    float bias_amt = 0.00044f
+);
+
+// Same walk as trace_shadow_instance() and raymarch_model_occupancy() in
+// common.comp, over the output of SvoDag::serialize_occupancy(). Whether the
+// ray hits a solid voxel within flat_max_iters steps. `dir` must be
+// normalized.
+bool trace_occupancy(
+    std::span<const OccupancyNode> nodes, uint32_t level, const Ray ray,
+    float bias_amt = 0.00044f
+);
+
+const size_t packet_size = 4;
+
+// trace_flat() of packet_size rays at once, with the same results. While the
+// rays stand in the same node it is fetched once for all of them and their
+// slab tests run side by side, with SSE where available. Once they part ways
+// each ray finishes on its own, so packets should hold neighbouring rays.
+std::array<FlatTraceResult, packet_size> trace_flat_packet(
+    std::span<const SerializedNode> nodes, uint32_t level,
+    std::span<const Ray, packet_size> rays, float bias_amt = 0.00044f
+);
+
+// Pinhole camera in the terms the shaders get it: primary rays go through
+// pos + dir + x * right + y * up for x, y in [-1, 1], with right and up as
+// returned by Camera::camera_x_basis() and camera_y_basis()
+typedef struct {
+    glm::vec3 pos;
+    glm::vec3 dir;
+    glm::vec3 right;
+    glm::vec3 up;
+} CpuCamera;
+
+typedef struct {
+    const SvoDag* svodag;
+    glm::mat4 transform; // Model to world, like Transformable
+} CpuInstance;
+
+// Renders the nearest hit of the instances into `image`, which holds width *
+// height pixels with the top row first. Tiles of tile_size^2 pixels are
+// spread over every thread of `pool` and stolen from busy threads once a
+// thread runs out of its own. Within a tile, rays go out in
+// trace_flat_packet()s of 2x2 pixels. Each distinct tree is serialized once
+// per call.
+void render_cpu(
+    const CpuCamera& camera, std::span<const CpuInstance> instances, int width,
+    int height, std::span<std::array<std::byte, 4>> image, ThreadPool& pool,
+    int tile_size = 16
+);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef ENVIRONMENT_HPP
+#define ENVIRONMENT_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Faces of the luminance table are box filtered down to at most this size.
+// phat() reads the skybox at a coarse LOD anyway, so finer texels would only
+// make the table larger.
+const int environment_resolution = 32;
+
+// Matches `AliasEntry` in common.comp (std430). Texel i is drawn by picking
+// an entry uniformly and keeping i if u < threshold, otherwise taking alias.
+typedef struct alignas(4) AliasEntry {
+    alignas(4) float threshold;
+    alignas(4) uint32_t alias;
+    alignas(4) float probability; // Chance of drawing this texel
+} AliasEntry;
+
+static_assert(
+    sizeof(AliasEntry) == 12, "AliasEntry must match the std430 layout"
+);
+
+// Vose's alias method. The weights do not need to be normalized, but have to
+// sum up to more than 0.
+std::vector<AliasEntry> build_alias_table(std::span<const float> weights);
+
+// Luminance times solid angle of each texel of a cubemap given as six sRGB
+// RGBA8 faces, in the face order and orientation of GL cube maps. Texel
+// (x, y) of face f ends up at f * resolution^2 + y * resolution + x, where
+// resolution is min(width, environment_resolution).
+std::vector<float> environment_weights(
+    const std::array<std::span<const std::byte>, 6>& faces, int width
+);
+
+#endif
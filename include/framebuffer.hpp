@@ -0,0 +1,37 @@
+#ifndef FRAMEBUFFER_HPP
+#define FRAMEBUFFER_HPP
+
+#include "texture.hpp"
+
+#include <glbinding/gl/gl.h>
+
+class Framebuffer {
+    // An owning framebuffer with a single color attachment, and optionally a
+    // depth attachment
+public:
+    Framebuffer() noexcept;
+    Framebuffer(const Texture2D& color_attachment);
+    Framebuffer(
+        const Texture2D& color_attachment, const Texture2D& depth_attachment
+    );
+
+    ~Framebuffer() noexcept;
+
+    Framebuffer(Framebuffer& other) = delete;
+    Framebuffer(Framebuffer&& other) noexcept;
+
+    Framebuffer& operator=(Framebuffer& other) = delete;
+    Framebuffer& operator=(Framebuffer&& other) noexcept;
+
+    void bind() const noexcept;
+    static void bind_default() noexcept;
+
+    gl::GLuint get() const noexcept;
+
+private:
+    void check_complete() const;
+
+    gl::GLuint framebuffer;
+};
+
+#endif
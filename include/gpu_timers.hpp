@@ -0,0 +1,86 @@
+#ifndef GPU_TIMERS_HPP
+#define GPU_TIMERS_HPP
+
+#include <glbinding/gl/gl.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Measures GPU time per pass with GL_TIME_ELAPSED queries. Results are read
+// `latency` frames after they were issued, by when the GPU has long finished
+// them, so that timing never stalls the pipeline.
+class GpuTimers {
+public:
+    static const size_t latency = 4;
+
+    typedef struct Stats {
+        size_t samples;
+        // In milliseconds
+        double average;
+        double p50;
+        double p95;
+        double p99;
+    } Stats;
+
+    GpuTimers() noexcept
+        : frame(0), active(no_pass), history_size(0), next_record(0) {};
+    GpuTimers(std::vector<std::string> pass_names, size_t history_size = 1024);
+    ~GpuTimers() noexcept;
+
+    GpuTimers(GpuTimers&& other) noexcept;
+    GpuTimers& operator=(GpuTimers&& other) noexcept;
+
+    GpuTimers(const GpuTimers&) = delete;
+    GpuTimers& operator=(const GpuTimers&) = delete;
+
+    // Collects the results of `latency` frames ago and recycles their queries
+    void begin_frame();
+
+    // Queries of this kind cannot nest, so only one pass may be open at a
+    // time. A pass that was already timed this frame is not timed again.
+    void begin(size_t pass);
+    void end();
+
+    // The pass after the last one is the sum over all passes of a frame. A
+    // default constructed GpuTimers has no passes, not even that one.
+    inline size_t pass_count() const noexcept {
+        return names.empty() ? 0 : names.size() - 1;
+    }
+    inline const std::string& name(size_t pass) const noexcept {
+        return names[pass];
+    }
+    Stats stats(size_t pass) const;
+    // Forgets the recorded frames, e.g. those of a warmup
+    void clear();
+    // Waits for and records the frames still in flight, before the results
+    // are written out for good
+    void flush();
+
+    // One row per recorded frame, in milliseconds. Passes that did not run
+    // in a frame are left empty.
+    void write_csv(const std::filesystem::path& path) const;
+    // stats() of every pass
+    void write_json(const std::filesystem::path& path) const;
+
+private:
+    static const size_t no_pass = ~size_t(0);
+
+    std::vector<float> samples(size_t pass) const;
+
+    std::vector<std::string> names;
+
+    // latency slots of one query per pass
+    std::vector<gl::GLuint> queries;
+    std::vector<bool> issued;
+    size_t frame;
+    size_t active;
+
+    // Ring of per-frame records, NaN where a pass did not run
+    std::vector<std::vector<float>> history;
+    size_t history_size;
+    size_t next_record;
+};
+
+#endif
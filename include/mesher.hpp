@@ -0,0 +1,40 @@
+#ifndef MESHER_HPP
+#define MESHER_HPP
+
+#include "material_list.hpp"
+#include "svodag.hpp"
+#include "thread_pool.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Greedy meshes of the surface of a tree, for rasterizing primary visibility.
+// The tree is meshed in chunks of 2^mesh_chunk_level voxels per edge and
+// quads only merge within a chunk. Whether a face is exposed depends on the
+// neighbours of its chunk as well, so each distinct combination of a chunk's
+// subtree and those of its six neighbours is meshed once; On deduplicated
+// trees that is far fewer meshings than chunks.
+
+const size_t mesh_chunk_level = 5;
+
+// A rectangle of exposed faces of one material. Matches `MeshQuad` in
+// mesh_gbuffer.vert.
+typedef struct {
+    std::array<uint32_t, 3> origin; // Lowest corner, on the face plane
+    uint32_t width;  // Along axis (face / 2 + 1) % 3
+    uint32_t height; // Along axis (face / 2 + 2) % 3
+    uint32_t face;   // -x, +x, -y, +y, -z, +z, so face / 2 is the axis
+    MatID_t mat_id;
+} MeshQuad;
+
+static_assert(sizeof(MeshQuad) == 28, "MeshQuad must match std430");
+
+// Exposed faces of the tree, in the voxel coordinates of SvoDag::get(). The
+// distinct chunks are meshed over `pool`, which must not be the pool of the
+// calling task.
+std::vector<MeshQuad>
+mesh_greedy(const SvoDag& svodag, ThreadPool* pool = nullptr);
+
+#endif
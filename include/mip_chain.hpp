@@ -0,0 +1,66 @@
+#ifndef MIP_CHAIN_HPP
+#define MIP_CHAIN_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+// A read only, memory mapped file
+class MappedFile {
+public:
+    MappedFile() noexcept : data(nullptr), length(0) {};
+    explicit MappedFile(const std::filesystem::path& path);
+    ~MappedFile() noexcept;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline std::span<const std::byte> bytes() const noexcept {
+        return {(const std::byte*)data, length};
+    }
+
+private:
+    void* data;
+    size_t length;
+};
+
+// Tightly packed RGBA8 image together with all of its mip levels, finest
+// first. The data is either owned or mapped from the cache.
+class MipChain {
+public:
+    MipChain() noexcept : width(0), height(0), levels(0) {};
+
+    // Decodes the image at path, or maps the result of an earlier decode from
+    // cache_dir. Cache entries are keyed by the hash of the file contents, so
+    // editing an image invalidates them.
+    static MipChain load(
+        const std::filesystem::path& path,
+        const std::filesystem::path& cache_dir = "cache"
+    );
+
+    // The levels are averaged in linear space since the data is sRGB
+    static MipChain build(std::vector<std::byte> image, int width, int height);
+
+    inline int get_levels() const noexcept { return levels; }
+    int get_width(int level = 0) const noexcept;
+    int get_height(int level = 0) const noexcept;
+
+    std::span<const std::byte> level(int level) const noexcept;
+
+private:
+    void write(const std::filesystem::path& path) const;
+
+    std::vector<std::byte> owned;
+    MappedFile mapped;
+    std::span<const std::byte> data; // Into either of the above
+
+    int width;
+    int height;
+    int levels;
+};
+
+#endif
@@ -2,72 +2,93 @@
 #define PROGRAM_HPP
 
 #include "common.hpp"
+#include "thread_pool.hpp"
 
 #include <glbinding/gl/gl.h>
 
+#include <cstdint>
 #include <filesystem>
-#include <regex>
+#include <map>
+#include <span>
+#include <string>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
-static const std::regex include_regex{"#include \"(.+)\""};
+// Name and value of each `#define` injected right after `#version`
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
 
-template <gl::GLenum type> class Shader {
-public:
-    Shader() noexcept : shader(0) {}
-    Shader(const std::filesystem::path& shader_path) noexcept
-        : shader(gl::glCreateShader(type)) {
-        std::string source = load_file(shader_path);
-        std::stringstream source_stream(source);
-        std::string line;
-        std::ostringstream preprocessed;
-        int i = 2;
-
-        while (std::getline(source_stream, line)) {
-            std::smatch match;
-            if (std::regex_search(line, match, include_regex)) {
-                preprocessed << "#line 1 1" << '\n';
-                preprocessed << load_file(std::filesystem::path(match[1]));
-                preprocessed << "#line " << i << " 0" << '\n';
-            } else if (line ==
-                       "#extension GL_ARB_shading_language_include : require") {
-                preprocessed << "\n\n";
-            } else {
-                preprocessed << line << '\n';
-            }
-
-            i++;
-        }
+// Resolves `#include "..."` lines against the working directory, the same
+// way GL_ARB_shading_language_include would with the shaders at its root.
+std::string preprocess_shader(
+    const std::filesystem::path& shader_path, const ShaderDefines& defines = {}
+);
 
-        source = preprocessed.str();
+// Starts preprocessing these shaders on the pool. preprocess_shader() then
+// waits for those results instead of reading the files again.
+void prefetch_shaders(
+    ThreadPool& pool, const std::vector<std::filesystem::path>& paths
+);
 
-        const char* source_buf = source.c_str();
-        gl::glShaderSource(shader, 1, &source_buf, NULL);
-        gl::glCompileShader(shader);
+// Lets the driver compile on its own threads if it supports
+// GL_KHR_parallel_shader_compile. Returns whether it does.
+bool enable_parallel_shader_compile();
 
-        int buflen;
-        gl::glGetShaderiv(shader, gl::GLenum::GL_INFO_LOG_LENGTH, &buflen);
-        std::unique_ptr<char[]> buf = std::make_unique<char[]>(buflen);
-        gl::glGetShaderInfoLog(shader, buflen, &buflen, buf.get());
+template <gl::GLenum type> class Shader {
+public:
+    static constexpr gl::GLenum shader_type = type;
 
-        SPDLOG_INFO("Filename: {}", shader_path.string());
-        SPDLOG_INFO(buf.get());
-    }
+    Shader() noexcept : shader(0) {}
+    // Only preprocesses; Program compiles the shader if it has no cached
+    // binary for the result.
+    Shader(
+        const std::filesystem::path& shader_path,
+        const ShaderDefines& defines = {}
+    )
+        : shader(0), path(shader_path),
+          source(preprocess_shader(shader_path, defines)) {}
     ~Shader() noexcept { gl::glDeleteShader(shader); }
 
     Shader(Shader& other) = delete;
-    Shader(Shader&& other) noexcept : shader(other.shader) { other.shader = 0; }
+    Shader(Shader&& other) noexcept
+        : shader(other.shader), path(std::move(other.path)),
+          source(std::move(other.source)) {
+        other.shader = 0;
+    }
 
     Shader& operator=(Shader& other) = delete;
     Shader& operator=(Shader&& other) noexcept {
         using std::swap;
 
         swap(shader, other.shader);
+        swap(path, other.path);
+        swap(source, other.source);
+
+        return *this;
+    }
+
+    // Does not wait for the result; Program reads the info log once it needs
+    // the program anyway
+    void compile() noexcept {
+        if (shader != 0) {
+            return;
+        }
+
+        shader = gl::glCreateShader(type);
+
+        const char* source_buf = source.c_str();
+        gl::glShaderSource(shader, 1, &source_buf, NULL);
+        gl::glCompileShader(shader);
     }
 
     gl::GLuint get() const noexcept { return shader; }
+    const std::filesystem::path& get_path() const noexcept { return path; }
+    const std::string& get_source() const noexcept { return source; }
 
 private:
     gl::GLuint shader;
+    std::filesystem::path path;
+    std::string source;
 };
 
 template <typename T> struct is_shader : std::false_type {};
@@ -82,18 +103,27 @@ public:
     Program() noexcept;
 
     // TODO: Validate shader combination
+    // Only issues the compile and link. The result is checked on the first
+    // use() or get(), which gives a driver with parallel compilation the time
+    // in between.
     template <typename... Args>
-    Program(Args&&... args) : program(gl::glCreateProgram()) {
+    Program(Args&&... args)
+        : program(gl::glCreateProgram()), key(driver_hash()), pending(false) {
+        ((key = hash_shader(key, args)), ...);
+
+        if (load_binary(key)) {
+            return;
+        }
+
         attach(std::forward<Args>(args)...);
 
+        gl::glProgramParameteri(
+            program, gl::GLenum::GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+            gl::GL_TRUE
+        );
         gl::glLinkProgram(program);
 
-        int buflen;
-        gl::glGetProgramiv(program, gl::GLenum::GL_INFO_LOG_LENGTH, &buflen);
-        std::unique_ptr<char[]> buf = std::make_unique<char[]>(buflen);
-        gl::glGetProgramInfoLog(program, buflen, &buflen, buf.get());
-
-        SPDLOG_INFO(buf.get());
+        pending = true;
     }
 
     ~Program() noexcept;
@@ -108,7 +138,30 @@ public:
 
     void use() const noexcept;
 
+    // Whether the first use() would not have to wait for the driver. Always
+    // true without GL_KHR_parallel_shader_compile, as there is no telling.
+    bool ready() const noexcept;
+
 private:
+    // Binaries are only valid for the driver that produced them
+    static uint64_t driver_hash();
+
+    template <class U>
+        requires IsShader<std::remove_cvref_t<U>>
+    static uint64_t hash_shader(uint64_t hash, const U& shader) noexcept {
+        auto type = std::remove_cvref_t<U>::shader_type;
+        hash = fnv1a(std::as_bytes(std::span(&type, 1)), hash);
+
+        return fnv1a(std::as_bytes(std::span(shader.get_source())), hash);
+    }
+
+    // Returns false if there is no binary for key or the driver rejects it
+    bool load_binary(uint64_t key);
+    void store_binary(uint64_t key) const;
+
+    // Logs the compile and link results and stores the binary
+    void finish() const noexcept;
+
     template <class U, class... Args>
         requires IsShader<U>
     void attach(U&& arg, Args&&... args) noexcept {
@@ -119,10 +172,40 @@ private:
     template <class U>
         requires IsShader<U>
     void attach(U&& arg) noexcept {
+        arg.compile();
         gl::glAttachShader(program, arg.get());
+        shaders.emplace_back(arg.get(), arg.get_path());
     }
 
     gl::GLuint program;
+    uint64_t key;
+
+    // Attached until finish(), which also frees them
+    mutable std::vector<std::pair<gl::GLuint, std::filesystem::path>> shaders;
+    mutable bool pending;
+};
+
+// Compute programs built from one file with different defines. Each variant
+// is compiled the first time it is asked for and kept afterwards.
+class ComputeVariants {
+public:
+    ComputeVariants() noexcept = default;
+    ComputeVariants(const std::filesystem::path& path) noexcept : path(path) {}
+
+    typedef std::map<ShaderDefines, Program>::value_type Variant;
+
+    const Program& get(const ShaderDefines& defines = {});
+
+    // The variant for `defines` once the driver has finished it. Until then
+    // the variant returned last stands in, so that switching does not stall.
+    const Variant& get_ready(const ShaderDefines& defines = {});
+
+private:
+    Variant& find_or_compile(const ShaderDefines& defines);
+
+    std::filesystem::path path;
+    std::map<ShaderDefines, Program> programs;
+    const Variant* last = nullptr;
 };
 
 #endif
@@ -0,0 +1,72 @@
+#ifndef RAYCAST_HPP
+#define RAYCAST_HPP
+
+#include "cpu_raymarch.hpp"
+#include "svodag.hpp"
+#include "thread_pool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <entt/entt.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Ray casts in bulk for gameplay, e.g. picking, line of sight and
+// projectiles. Neighbouring rays of a batch are traced as one packet, so
+// batches are fastest with rays that start and point alike next to each
+// other.
+
+// Batches up to this many rays are cast on the calling thread, larger ones
+// are split into chunks of this size over the pool
+const size_t raycast_chunk_size = 1024;
+
+typedef struct {
+    bool hit;
+    glm::vec3 pos;    // In the space of the ray, just inside the voxel
+    glm::vec3 normal; // Of the face the ray entered through, unit length
+    MatID_t mat_id;
+    float distance; // From the origin of the ray to pos
+} RayHit;
+
+// Nearest hit of every ray against the serialized tree, all in model space
+void raycast_batch(
+    std::span<const SerializedNode> nodes, uint32_t level,
+    std::span<const Ray> rays, std::span<RayHit> hits,
+    ThreadPool* pool = nullptr
+);
+
+// The same against the tree itself. Serializes it first, so repeated casts
+// against a tree that does not change are better off with the nodes of
+// SvoDag::serialize(). Large batches are spread over `pool`, which must not
+// be the pool of the calling task.
+void raycast_batch(
+    const SvoDag& svodag, std::span<const Ray> rays, std::span<RayHit> hits,
+    ThreadPool* pool = nullptr
+);
+
+typedef struct {
+    std::span<const SerializedNode> nodes;
+    uint32_t level;
+    glm::mat4 transform; // Model to world, like Transformable
+    entt::entity entity;
+} RaycastInstance;
+
+typedef struct {
+    bool hit;
+    glm::vec3 pos;    // World space
+    glm::vec3 normal; // World space, unit length
+    MatID_t mat_id;
+    float distance; // From the origin of the ray to pos, in world units
+    entt::entity entity; // entt::null on a miss
+} SceneHit;
+
+// Nearest hit of every world space ray among the instances, which only get
+// traced where the ray passes their bounds
+void raycast_scene(
+    std::span<const RaycastInstance> instances, std::span<const Ray> rays,
+    std::span<SceneHit> hits, ThreadPool* pool = nullptr
+);
+
+#endif
@@ -1,15 +1,23 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include "aabb.hpp"
 #include "buffer.hpp"
+#include "bvh.hpp"
 #include "camera.hpp"
 #include "common.hpp"
+#include "environment.hpp"
+#include "framebuffer.hpp"
+#include "gpu_timers.hpp"
 #include "material.hpp"
 #include "material_list.hpp"
+#include "mesher.hpp"
 #include "program.hpp"
 #include "raii.hpp"
+#include "raycast.hpp"
 #include "svodag.hpp"
 #include "texture.hpp"
+#include "thread_pool.hpp"
 #include "vertex.hpp"
 #include "vertex_array.hpp"
 #include "window.hpp"
@@ -27,34 +35,143 @@
 
 #include <entt/entt.hpp>
 
+#include <array>
 #include <filesystem>
 #include <format>
 #include <functional>
+#include <future>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 typedef struct alignas(16) {
     alignas(16) glm::mat4 model_inv;
     alignas(16) glm::mat4 model;
     alignas(16) glm::mat4 model_norm;
+    alignas(16) glm::mat4 prev_model;
     alignas(4) unsigned int max_level;
     alignas(4) unsigned int at_index;
+    alignas(4) unsigned int occupancy_at_index;
 } SvodagMetaData;
 
+// Matches NO_OCCUPANCY in common.comp
+const unsigned int no_occupancy = 0xFFFFFFFF;
+
 typedef SimpleMaterial Material;
 
+const size_t max_instances = 4096;
+
+// Capacity of the quads of every registered mesh together
+const size_t max_mesh_quads = 1 << 18;
+
+// Must match TILE_SIZE and MAX_TILE_INSTANCES in common.comp
+const uint32_t bin_tile_size = 16;
+const uint32_t max_tile_instances = 128;
+
+// Matches the WAVEFRONT_* defines in common.comp
+enum WavefrontMode : int {
+    wavefront_off = 0,
+    wavefront_fill = 1,
+    wavefront_compacted = 2
+};
+
+// Index into the node fetch counters in common.comp and into gpu_timers.
+// Passes before pass_other are timed individually.
+enum RenderPass : int {
+    pass_first_hit,
+    pass_sample_generation,
+    pass_temporal_reuse,
+    pass_spatial_reuse,
+    pass_shade,
+    pass_before_reuse,
+    pass_after_reuse,
+    pass_velocity,
+    pass_bin_instances,
+    pass_ray_start,
+    pass_raster_gbuffer,
+    pass_other,
+    pass_count
+};
+
+const std::array<const char*, pass_count> pass_names = {
+    "First hit",    "Sample generation", "Temporal reuse",  "Spatial reuse",
+    "Shade",        "Before reuse",      "After reuse",     "Velocity",
+    "Tile binning", "Ray start",         "Raster G-buffer", "Other"
+};
+
+// Must match MAX_CACHED_MODELS in common.comp
+const size_t max_cached_models = 4;
+
+// Must match NODE_CACHE_SIZE in common.comp
+const size_t node_cache_size = 73;
+
+// Must match APRON_WIDTH in 3_spatial_reuse.comp
+const size_t spatial_apron_width = 36;
+
+// Matches `PackedSample` in common.comp
+typedef struct {
+    uint32_t normal;
+    uint32_t light_dir;
+    float depth;
+    uint32_t weights;
+    uint32_t mat_index;
+} PackedSample;
+
+static_assert(sizeof(PackedSample) == 20, "PackedSample must match std430");
+
+// Must match TRAVERSAL_LEVELS in common.comp
+const size_t traversal_levels = 16;
+
+// Matches the head of `traversal_stats_buf` in common.comp. A glm::uvec4 of
+// steps, node fetches, capped rays and rays follows for every pixel.
+typedef struct {
+    uint32_t rays;
+    uint32_t steps;
+    uint32_t fetches;
+    uint32_t capped;
+    std::array<uint32_t, traversal_levels> level_steps;
+} TraversalTotals;
+
+static_assert(
+    sizeof(TraversalTotals) == 80, "TraversalTotals must match std430"
+);
+
+// Matches `bin_stats` in common.comp
+typedef struct {
+    uint32_t total_entries;
+    uint32_t max_entries;
+    uint32_t overflowed_tiles;
+    uint32_t tiles;
+} TileBinStats;
+
 class Renderer {
 public:
-    Renderer(int width, int height);
+    // Without `present`, frames only go to the texture that read_image()
+    // reads, for contexts that have no default framebuffer
+    Renderer(int width, int height, bool visible = true, bool present = true);
 
     bool main_loop(
         entt::registry& registry, const std::function<void(Window&, Camera&)> f
     );
     GLFWwindow* get_window() const;
 
+    // Replaces the time based seed of the shaders, so that frames can be
+    // reproduced
+    inline void set_seed(float seed) noexcept { fixed_seed = seed; }
+
+    inline GpuTimers& get_gpu_timers() noexcept { return gpu_timers; }
+
+    // The last rendered frame without the UI, as sRGB RGBA8 rows from the top
+    std::vector<std::byte> read_image() const;
+
     inline size_t register_model(
         const std::vector<SerializedNode> model, const unsigned int max_level
     ) {
         size_t id = svodag_ssbo.size();
+        model_sizes[id] = model.size();
 
         for (auto& elem : model) {
             svodag_ssbo.push_back(elem);
@@ -65,6 +182,71 @@ public:
         return id;
     }
 
+    // Shadow rays of this model walk `occupancy` instead, which should come
+    // from SvoDag::serialize_occupancy() of the same tree.
+    inline size_t register_model(
+        const std::vector<SerializedNode> model,
+        const std::vector<OccupancyNode> occupancy, const unsigned int max_level
+    ) {
+        size_t id = register_model(model, max_level);
+        occupancy_offsets[id] = occupancy_ssbo.size();
+
+        for (auto& elem : occupancy) {
+            occupancy_ssbo.push_back(elem);
+        }
+
+        occupancy_ssbo.upload();
+
+        return id;
+    }
+
+    // Lets the first hit pass rasterize this model instead of marching it.
+    // The quads should come from mesh_greedy() of the same tree, and replace
+    // those of an earlier mesh of the model.
+    inline void
+    register_mesh(const size_t model_id, std::span<const MeshQuad> quads) {
+        auto old = mesh_ranges.find(model_id);
+        size_t old_count = old == mesh_ranges.end() ? 0 : old->second.second;
+
+        if (mesh_quads.size() - old_count + quads.size() > max_mesh_quads) {
+            SPDLOG_ERROR(
+                "A mesh of {} quads does not fit, {} of {} are in use",
+                quads.size(), mesh_quads.size() - old_count, max_mesh_quads
+            );
+            throw std::range_error(std::format(
+                "A mesh of {} quads does not fit, {} of {} are in use",
+                quads.size(), mesh_quads.size() - old_count, max_mesh_quads
+            ));
+        }
+
+        if (old != mesh_ranges.end()) {
+            auto [old_first, count] = old->second;
+            mesh_quads.erase(old_first, count);
+            mesh_ranges.erase(old);
+
+            for (auto& [id, range] : mesh_ranges) {
+                if (range.first > old_first) {
+                    range.first -= count;
+                }
+            }
+        }
+
+        size_t first = mesh_quads.size();
+        for (auto& quad : quads) {
+            mesh_quads.push_back(quad);
+        }
+
+        mesh_ranges[model_id] = {first, quads.size()};
+        mesh_quads.upload();
+    }
+
+    // Meshes the tree with mesh_greedy() in the background once rasterized
+    // first hits are first enabled, and registers the quads when they are
+    // done. Keeps a copy of the tree, which shares its nodes.
+    inline void register_mesh_source(const size_t model_id, SvoDag svodag) {
+        mesh_sources.insert_or_assign(model_id, std::move(svodag));
+    }
+
     inline MatID_t register_material(const Material& material) {
         MatID_t matid = materials.push_back(material);
         materials.upload();
@@ -72,67 +254,159 @@ public:
         return matid;
     }
 
+    // raycast_scene() against the visible instances of `registry`, on the
+    // models as registered here. Rays are in world space.
+    void raycast_batch(
+        const entt::registry& registry, std::span<const Ray> rays,
+        std::span<SceneHit> hits
+    );
+
     void use_cubemap(const std::array<std::filesystem::path, 6>&);
 
 private:
-    void bind_everything();
+    void build_programs();
+    void bind_everything(bool specialized = false);
+    ShaderDefines shader_defines() const;
+    const ComputeVariants::Variant& variant(ComputeVariants& variants);
+    void dispatch(
+        const Program& program, RenderPass pass,
+        gl::MemoryBarrierMask barriers, WavefrontMode mode = wavefront_off,
+        bool specialized = false
+    );
+    void dispatch(
+        ComputeVariants& variants, RenderPass pass,
+        gl::MemoryBarrierMask barriers, WavefrontMode mode = wavefront_off
+    );
+    void select_cached_models();
+    void bin_instances();
+    void spatial_reuse_passes();
+    void rasterize_ray_start();
+    void rasterize_gbuffer();
+    void collect_meshes();
+    void write_traversal_stats(
+        const std::filesystem::path& pixels_path,
+        const std::filesystem::path& levels_path
+    );
 
     int width;
     int height;
+    bool present;
+
+    ThreadPool workers;
 
     Window window;
     Buffer<gl::GL_ARRAY_BUFFER> vbo;
     VertexArray vao;
     Buffer<gl::GL_ELEMENT_ARRAY_BUFFER> ibo;
 
-    Program quad_renderer = Program{
-        Shader<gl::GL_VERTEX_SHADER>(std::filesystem::path("simple.vert")),
-        Shader<gl::GL_FRAGMENT_SHADER>(
-            std::filesystem::path("draw_texture.frag")
-        )
-    };
+    // Built by build_programs()
+    Program quad_renderer;
+    Program box_depth;
+    Program mesh_gbuffer;
+    Program velocity;
+    Program instance_projection;
+    Program tile_binning;
+    Program traversal_heatmap;
 
-    Program micro_restir_first_hit = Program{
-        Shader<gl::GL_COMPUTE_SHADER>(std::filesystem::path("0_first_hit.comp"))
-    };
+    // The ReSTIR passes read the toggles of shader_defines()
+    ComputeVariants micro_restir_first_hit =
+        ComputeVariants{std::filesystem::path("0_first_hit.comp")};
 
-    Program micro_restir_sample_generation =
-        Program{Shader<gl::GL_COMPUTE_SHADER>(
-            std::filesystem::path("1_sample_generation.comp")
-        )};
+    ComputeVariants micro_restir_sample_generation =
+        ComputeVariants{std::filesystem::path("1_sample_generation.comp")};
 
-    Program micro_restir_temporal_reuse = Program{Shader<gl::GL_COMPUTE_SHADER>(
-        std::filesystem::path("2_temporal_reuse.comp")
-    )};
+    ComputeVariants micro_restir_temporal_reuse =
+        ComputeVariants{std::filesystem::path("2_temporal_reuse.comp")};
 
-    Program micro_restir_spatial_reuse = Program{Shader<gl::GL_COMPUTE_SHADER>(
-        std::filesystem::path("3_spatial_reuse.comp")
-    )};
+    ComputeVariants micro_restir_spatial_reuse =
+        ComputeVariants{std::filesystem::path("3_spatial_reuse.comp")};
 
-    Program micro_restir_shade = Program{
-        Shader<gl::GL_COMPUTE_SHADER>(std::filesystem::path("4_shade.comp"))
-    };
+    ComputeVariants micro_restir_shade =
+        ComputeVariants{std::filesystem::path("4_shade.comp")};
 
-    Program restir_before_reuse = Program{Shader<gl::GL_COMPUTE_SHADER>(
-        std::filesystem::path("before_reuse.comp")
-    )};
+    ComputeVariants restir_before_reuse =
+        ComputeVariants{std::filesystem::path("before_reuse.comp")};
 
-    Program restir_after_reuse = Program{
-        Shader<gl::GL_COMPUTE_SHADER>(std::filesystem::path("after_reuse.comp"))
-    };
+    ComputeVariants restir_after_reuse =
+        ComputeVariants{std::filesystem::path("after_reuse.comp")};
 
     AppendBuffer<SerializedNode, gl::GL_SHADER_STORAGE_BUFFER> svodag_ssbo;
     VectorBuffer<SvodagMetaData, gl::GL_SHADER_STORAGE_BUFFER> metadata_ssbo;
     AppendBuffer<Material, gl::GL_SHADER_STORAGE_BUFFER> materials;
+    AppendBuffer<OccupancyNode, gl::GL_SHADER_STORAGE_BUFFER> occupancy_ssbo;
+    AppendBuffer<MeshQuad, gl::GL_SHADER_STORAGE_BUFFER> mesh_quads;
+
+    // Offset in occupancy_ssbo of each registered model, keyed like
+    // model_sizes
+    std::unordered_map<size_t, size_t> occupancy_offsets;
+
+    // First quad in mesh_quads and quad count of each registered mesh, keyed
+    // like model_sizes
+    std::unordered_map<size_t, std::pair<size_t, size_t>> mesh_ranges;
+
+    // Trees of register_mesh_source() not meshed yet, and the meshes in
+    // flight. The futures join on destruction, so they come after workers.
+    std::unordered_map<size_t, SvoDag> mesh_sources;
+    std::unordered_map<size_t, std::future<std::vector<MeshQuad>>>
+        pending_meshes;
+
+    // Node count of each registered model, keyed by its offset in svodag_ssbo
+    std::unordered_map<size_t, size_t> model_sizes;
+    glm::uvec4 cached_models{};
+    glm::uvec4 cached_model_sizes{};
+    int cached_model_count = 0;
+
+    ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> node_fetch_stats;
+    GpuTimers gpu_timers;
+
+    // Per pixel counters of the TRAVERSAL_STATS variants
+    ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> traversal_stats;
+    TraversalTotals last_traversal_totals{};
+    std::array<glm::uvec2, pass_count> last_node_fetch_stats{};
+
+    InstanceBvh instance_bvh;
+    std::vector<Aabb> instance_bounds;
+    VectorBuffer<BvhNode, gl::GL_SHADER_STORAGE_BUFFER> bvh_ssbo;
+    VectorBuffer<uint32_t, gl::GL_SHADER_STORAGE_BUFFER> bvh_index_ssbo;
+
+    ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> instance_rects;
+    ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> tile_counts;
+    ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> tile_instances;
+    ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> bin_stats;
+    TileBinStats last_bin_stats{};
+
+    // 16 byte header of indirect dispatch arguments and a counter, followed
+    // by one pixel index per pixel
+    ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> wavefront_queue;
 
     ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> reservoirs;
     ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> prev_reservoirs;
+    ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> spatial_reservoirs;
+    ImmutableBuffer<gl::GL_SHADER_STORAGE_BUFFER> hit_instances;
     bool is_first_frame = true;
 
+    // Transform of every visible entity in the previous frame
+    std::unordered_map<entt::entity, glm::mat4> prev_transforms;
+
     Camera camera;
 
+    // The camera that produced prev_reservoirs
+    glm::vec3 prev_camera_pos{};
+    glm::vec3 prev_camera_dir{};
+    glm::vec3 prev_camera_x_basis{};
+    glm::vec3 prev_camera_y_basis{};
+
     CubeMap cubemap;
+    // Alias table over the texels of cubemap, see environment.hpp
+    Buffer<gl::GL_SHADER_STORAGE_BUFFER> environment_table;
+    uint32_t environment_table_resolution = 0;
     Texture2D quad_texture;
+    Texture2D ray_start_texture;
+    Framebuffer ray_start_fbo;
+    Texture2D gbuffer_texture;
+    Texture2D gbuffer_depth_texture;
+    Framebuffer gbuffer_fbo;
+    Texture2D motion_texture;
 
     float bias_amt = 0.00044f;
     float surface_bias_amt = 0.00187f;
@@ -146,6 +420,24 @@ private:
     bool spatial_reuse = true;
     bool spatial_first = true;
     bool visibility_reuse = true;
+    bool use_instance_bvh = true;
+    bool use_tile_bins = true;
+    bool show_bin_stats = false;
+    bool use_ray_start = true;
+    bool use_raster_gbuffer = false;
+    // Only when every visible instance has a mesh, and the first hit pass is
+    // not part of the megakernel
+    bool raster_gbuffer_active = false;
+    bool use_node_cache = true;
+    bool use_occupancy = true;
+    bool use_environment_sampling = true;
+    bool specialize_shaders = true;
+    bool show_node_fetch_stats = false;
+    bool show_gpu_timings = false;
+    std::optional<float> fixed_seed;
+    bool collect_traversal_stats = false;
+    int traversal_heatmap_metric = 0; // 0 off, else 1 + heatmap_metric
+    float traversal_heatmap_max = 100.0f;
 
     bool debug_normal_view = false;
     bool debug_pos_view = false;
@@ -153,8 +445,11 @@ private:
     bool debug_ignore_shadow = false;
     bool debug_visualize_shadow = false;
     bool megakernel = true;
+    bool wavefront = true;
 
     int initial_sample_count = 5;
+    int spatial_neighbor_count = 2;
+    int spatial_iterations = 1;
 };
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef SVODAG_H
 #define SVODAG_H
 
+#include "aabb.hpp"
 #include "common.hpp"
 #include "material_list.hpp"
 
@@ -15,6 +16,7 @@
 #include <optional>
 #include <queue>
 #include <ranges>
+#include <span>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -41,13 +43,60 @@ typedef struct alignas(4) SerializedNode {
 } SerializedNode;
 // Good enough for now
 
+// Child pointers of the geometry-only DAG from SvoDag::serialize_occupancy().
+// Anything else is the index of an interior node.
+const Addr_t occupancy_empty = 0;
+const Addr_t occupancy_solid = 0xFFFFFFFF;
+const Addr_t occupancy_brick = 0x80000000; // | mask of the 2x2x2 solid voxels
+
+typedef struct alignas(4) OccupancyNode {
+    alignas(4) std::array<Addr_t, 8> child; // 32 Bytes, same order as addr
+
+    bool operator==(const OccupancyNode& other) const = default;
+} OccupancyNode;
+
+template <> struct std::hash<OccupancyNode> {
+    std::size_t operator()(OccupancyNode const& node) const noexcept;
+};
+
 class SvoNode;
+class ThreadPool;
+
+typedef struct {
+    glm::vec3 origin;
+    glm::vec3 dir; // Must be normalized
+} Ray;
 
 typedef struct {
     std::shared_ptr<SvoNode> node;
     size_t at_level; // Level is maximum at root
 } QueryResult;
 
+// A uniform solid node, which may be far larger than a voxel
+typedef struct {
+    Aabb bounds; // In model space
+    MatID_t mat_id;
+} SolidCell;
+
+// Voxels in [min, max), in the coordinates of SvoDag::get()
+typedef struct {
+    glm::uvec3 min;
+    glm::uvec3 max;
+} VoxelBox;
+
+// SvoDag::extract() only uses its pool for boxes of more voxels than this
+const size_t extract_parallel_volume = 32 * 32 * 32;
+
+// Where each subtree was first extracted to, by level
+typedef std::vector<std::unordered_map<const SvoNode*, glm::uvec3>>
+    ExtractMemo;
+
+typedef struct {
+    float t; // Fraction of the velocity the box moves freely, 1 if unblocked
+    glm::vec3 normal; // Of the face it stops against, zero if unblocked
+    MatID_t mat_id;   // Of the node it stops against, 0 if unblocked
+} SweepResult;
+
 template <typename CharT> struct std::formatter<SerializedNode, CharT> {
     template <typename FormatParseContext>
     constexpr auto parse(FormatParseContext& pc) {
@@ -87,11 +136,30 @@ public:
         const size_t level) const noexcept;
     MatID_t get_mat_id() const noexcept;
     const std::array<std::shared_ptr<SvoNode>, 8> get_children() const noexcept;
+    // Without copying the pointers, for walks that only look
+    const SvoNode* get_child(const size_t index) const noexcept;
     const std::optional<QueryResult> query(
         const size_t x_bitmask, const size_t y_bitmask, const size_t z_bitmask,
         const size_t level
     ) const noexcept;
 
+    // Box queries over the subtree spanning `cell`, which callers only
+    // descend into when it is relevant to the box
+    bool overlaps(const Aabb& cell, const Aabb& box) const noexcept;
+    void collect_solid(
+        const Aabb& cell, const Aabb& box, std::vector<SolidCell>& out
+    ) const;
+    void sweep(
+        const Aabb& cell, const Aabb& box, const glm::vec3 velocity,
+        SweepResult& nearest
+    ) const noexcept;
+    // Fills the part of out, laid out as in SvoDag::extract(), that the
+    // subtree with its lowest voxel at origin covers
+    void extract(
+        const glm::uvec3 origin, const size_t level, const VoxelBox& box,
+        std::span<MatID_t> out, ExtractMemo& memo
+    ) const noexcept;
+
     void dedup(
         std::unordered_map<SvoNode, std::shared_ptr<SvoNode>>& map,
         size_t target_depth /*Opposite of level*/
@@ -130,7 +198,33 @@ public:
     const QueryResult query(const glm::vec3 pos) const noexcept;
 
     const std::vector<SerializedNode> serialize() const noexcept;
+    // Drops materials so that far more subtrees dedup, and stores the nodes
+    // right above the voxels inline as bitmasks. The root is at index 0.
+    const std::vector<OccupancyNode> serialize_occupancy() const noexcept;
     inline size_t get_level() const noexcept { return level; }
+    inline const SvoNode* get_root() const noexcept { return root.get(); }
+
+    // Box queries for physics, with boxes in model space where the tree spans
+    // (0, 0, 0) ~ (1, 1, 1). Only nodes the box touches are visited, and
+    // uniform nodes are answered whole. Touching a face does not count as
+    // overlapping.
+    bool overlaps(const Aabb& box) const noexcept;
+    // Appends the solid nodes overlapping the box, unclipped
+    void collect_solid(const Aabb& box, std::vector<SolidCell>& out) const;
+    // How far the box can move along velocity before it touches solid. A box
+    // that starts out overlapping solid is stuck at t = 0.
+    const SweepResult
+    sweep(const Aabb& box, const glm::vec3 velocity) const noexcept;
+
+    // Materials of the voxels in the box into out, x fastest, then y, then z,
+    // with 0 outside the tree. Uniform nodes are filled row by row and
+    // repeated subtrees are copied from where they were first extracted.
+    // Large boxes are extracted by octant over `pool`, which must not be the
+    // pool of the calling task.
+    void extract(
+        const VoxelBox& box, std::span<MatID_t> out,
+        ThreadPool* pool = nullptr
+    ) const;
 
     void dedup() noexcept;
 
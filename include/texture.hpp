@@ -1,10 +1,13 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
+#include "mip_chain.hpp"
+
 #include <glbinding/gl/gl.h>
 
 #include <spdlog/spdlog.h>
 
+#include <array>
 #include <ranges>
 #include <span>
 
@@ -26,6 +29,8 @@ public:
     Texture(const Texture&) = delete;
     Texture& operator=(const Texture&) = delete;
 
+    gl::GLuint get() const noexcept { return texture; }
+
 protected:
     gl::GLuint texture;
 };
@@ -71,6 +76,13 @@ class CubeMap : public Texture {
 public:
     CubeMap() noexcept;
 
+    // Uploads the first `levels` levels of each face instead of generating
+    // them on the GPU. The faces must be square and of the same size.
+    CubeMap(
+        const std::array<MipChain, 6>& faces, gl::GLenum internal_format,
+        gl::GLsizei levels = 7
+    );
+
     template <typename T>
     CubeMap(
         std::array<std::span<T>, 6> images, gl::GLenum internal_format,
@@ -0,0 +1,56 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed set of worker threads draining a FIFO of tasks. Tasks must not
+// block on the futures of other tasks of the same pool.
+class ThreadPool {
+public:
+    explicit ThreadPool(
+        unsigned int thread_count = std::thread::hardware_concurrency()
+    );
+    ~ThreadPool() noexcept;
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F&& f) {
+        using Result = std::invoke_result_t<F>;
+
+        auto task = std::make_shared<std::packaged_task<Result()>>(
+            std::forward<F>(f)
+        );
+        auto future = task->get_future();
+
+        {
+            std::lock_guard lock(mutex);
+            tasks.emplace([task]() { (*task)(); });
+        }
+        condition.notify_one();
+
+        return future;
+    }
+
+    inline size_t size() const noexcept { return threads.size(); }
+
+private:
+    void work();
+
+    std::vector<std::thread> threads;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+};
+
+#endif
@@ -6,7 +6,11 @@
 
 class Window {
 public:
-    Window(int width, int height, const char* name) noexcept;
+    // Invisible windows still get a default framebuffer of the given size,
+    // which is enough for offscreen rendering
+    Window(
+        int width, int height, const char* name, bool visible = true
+    ) noexcept;
     ~Window() noexcept;
 
     Window(Window& other) = delete;
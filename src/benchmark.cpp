@@ -0,0 +1,278 @@
+#include "benchmark.hpp"
+#include "components.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/euler_angles.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+template <typename T>
+T parse_number(std::string_view name, std::string_view s) {
+    T value;
+    auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), value);
+
+    if (error != std::errc() || end != s.data() + s.size()) {
+        throw std::runtime_error(
+            std::format("Invalid value '{}' for {}", s, name)
+        );
+    }
+
+    return value;
+}
+
+// Rows of exactly `columns` numbers. Empty lines, lines starting with '#' and
+// a header row are skipped.
+std::vector<std::vector<float>>
+read_csv(const std::filesystem::path& path, size_t columns) {
+    std::ifstream file(path);
+
+    if (!file.is_open()) {
+        SPDLOG_CRITICAL("Could not open the file {}", path.string());
+        throw std::runtime_error(
+            std::format("Could not open the file {}", path.string())
+        );
+    }
+
+    std::vector<std::vector<float>> rows;
+    std::string line;
+    for (size_t line_number = 1; std::getline(file, line); line_number++) {
+        if (line.empty() || line[0] == '#' ||
+            (rows.empty() && std::isalpha((unsigned char)line[0]))) {
+            continue;
+        }
+
+        std::vector<float> row;
+        std::istringstream cells(line);
+        std::string cell;
+        while (std::getline(cells, cell, ',')) {
+            cell.erase(0, cell.find_first_not_of(" \t"));
+            cell.erase(cell.find_last_not_of(" \t\r") + 1);
+
+            row.push_back(parse_number<float>(
+                std::format("{}:{}", path.string(), line_number), cell
+            ));
+        }
+
+        if (row.size() != columns) {
+            throw std::runtime_error(std::format(
+                "{}:{} has {} columns instead of {}", path.string(),
+                line_number, row.size(), columns
+            ));
+        }
+
+        rows.push_back(std::move(row));
+    }
+
+    return rows;
+}
+
+// Index of the last key at or before `time` among keys sorted by time, and
+// how far `time` is towards the next one
+template <typename Key>
+std::pair<size_t, float> locate(std::span<const Key> keys, float time) {
+    auto next = std::upper_bound(
+        keys.begin(), keys.end(), time,
+        [](float t, const Key& key) { return t < key.time; }
+    );
+
+    if (next == keys.begin()) {
+        return {0, 0.0f};
+    }
+    if (next == keys.end()) {
+        return {keys.size() - 1, 0.0f};
+    }
+
+    const Key& prev = *(next - 1);
+    float t = (time - prev.time) / (next->time - prev.time);
+
+    return {size_t(next - keys.begin()) - 1, t};
+}
+} // namespace
+
+BenchmarkOptions parse_options(std::span<char* const> args) {
+    BenchmarkOptions options;
+
+    for (size_t i = 1; i < args.size(); i++) {
+        std::string_view arg = args[i];
+
+        auto value = [&]() -> std::string_view {
+            if (i + 1 >= args.size()) {
+                throw std::runtime_error(std::format("{} needs a value", arg));
+            }
+
+            return args[++i];
+        };
+
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--surfaceless") {
+            options.headless = true;
+            options.surfaceless = true;
+        } else if (arg == "--width") {
+            options.width = parse_number<int>(arg, value());
+        } else if (arg == "--height") {
+            options.height = parse_number<int>(arg, value());
+        } else if (arg == "--frames") {
+            options.frames = parse_number<int>(arg, value());
+        } else if (arg == "--warmup") {
+            options.warmup_frames = parse_number<int>(arg, value());
+        } else if (arg == "--capture-every") {
+            options.capture_every = parse_number<int>(arg, value());
+        } else if (arg == "--frame-time") {
+            options.frame_time = parse_number<float>(arg, value());
+        } else if (arg == "--seed") {
+            options.seed = parse_number<float>(arg, value());
+        } else if (arg == "--camera-path") {
+            options.camera_path = value();
+        } else if (arg == "--timeline") {
+            options.timeline = value();
+        } else if (arg == "--output") {
+            options.output_dir = value();
+        } else {
+            throw std::runtime_error(std::format("Unknown argument {}", arg));
+        }
+    }
+
+    if (options.width <= 0 || options.height <= 0 || options.frames <= 0 ||
+        options.warmup_frames < 0 || options.capture_every < 0 ||
+        options.frame_time <= 0.0f) {
+        throw std::runtime_error("Sizes, counts and times must be positive");
+    }
+
+    return options;
+}
+
+std::string usage() {
+    return "Usage: voxel-engine [--width W] [--height H]\n"
+           "       voxel-engine --headless|--surfaceless [--width W] "
+           "[--height H]\n"
+           "           [--frames N] [--warmup N] [--capture-every N]\n"
+           "           [--frame-time SECONDS] [--seed S]\n"
+           "           [--camera-path CSV] [--timeline CSV] [--output DIR]\n";
+}
+
+CameraPath::CameraPath(std::vector<CameraKey> keys) : keys(std::move(keys)) {
+    std::stable_sort(
+        this->keys.begin(), this->keys.end(),
+        [](const CameraKey& a, const CameraKey& b) { return a.time < b.time; }
+    );
+}
+
+CameraPath CameraPath::load(const std::filesystem::path& path) {
+    std::vector<CameraKey> keys;
+    for (auto& row : read_csv(path, 6)) {
+        keys.push_back(CameraKey{
+            row[0], glm::vec3(row[1], row[2], row[3]), row[4], row[5]
+        });
+    }
+
+    return CameraPath(std::move(keys));
+}
+
+CameraKey CameraPath::at(float time) const {
+    auto [i, t] = locate(std::span<const CameraKey>(keys), time);
+
+    if (t == 0.0f) {
+        return keys[i];
+    }
+
+    const CameraKey& a = keys[i];
+    const CameraKey& b = keys[i + 1];
+
+    return CameraKey{
+        time, glm::mix(a.pos, b.pos, t), glm::mix(a.pitch, b.pitch, t),
+        glm::mix(a.yaw, b.yaw, t)
+    };
+}
+
+TransformTimeline::TransformTimeline(std::vector<TransformKey> keys)
+    : keys(std::move(keys)) {
+    std::stable_sort(
+        this->keys.begin(), this->keys.end(),
+        [](const TransformKey& a, const TransformKey& b) {
+            return std::pair(a.instance, a.time) <
+                   std::pair(b.instance, b.time);
+        }
+    );
+}
+
+TransformTimeline TransformTimeline::load(const std::filesystem::path& path) {
+    std::vector<TransformKey> keys;
+    for (auto& row : read_csv(path, 11)) {
+        keys.push_back(TransformKey{
+            row[0], size_t(row[1]), glm::vec3(row[2], row[3], row[4]),
+            glm::vec3(row[5], row[6], row[7]),
+            glm::vec3(row[8], row[9], row[10])
+        });
+    }
+
+    return TransformTimeline(std::move(keys));
+}
+
+glm::mat4 TransformTimeline::at(size_t instance, float time) const {
+    auto [first, last] = std::equal_range(
+        keys.begin(), keys.end(), TransformKey{0.0f, instance},
+        [](const TransformKey& a, const TransformKey& b) {
+            return a.instance < b.instance;
+        }
+    );
+
+    if (first == last) {
+        throw std::runtime_error(
+            std::format("The timeline has no keys for instance {}", instance)
+        );
+    }
+
+    std::span<const TransformKey> instance_keys(first, last);
+    auto [i, t] = locate(instance_keys, time);
+
+    TransformKey key = instance_keys[i];
+    if (t != 0.0f) {
+        const TransformKey& next = instance_keys[i + 1];
+
+        key.translation = glm::mix(key.translation, next.translation, t);
+        key.rotation = glm::mix(key.rotation, next.rotation, t);
+        key.scale = glm::mix(key.scale, next.scale, t);
+    }
+
+    glm::mat4 transform = glm::translate(glm::mat4(1.0f), key.translation) *
+                          glm::yawPitchRoll(
+                              key.rotation.y, key.rotation.x, key.rotation.z
+                          );
+
+    return glm::scale(transform, key.scale);
+}
+
+void TransformTimeline::apply(
+    float time, std::span<const entt::entity> instances,
+    entt::registry& registry
+) const {
+    for (size_t i = 0; i < keys.size();) {
+        size_t instance = keys[i].instance;
+
+        if (instance >= instances.size()) {
+            throw std::runtime_error(std::format(
+                "The timeline animates instance {}, but there are only {}",
+                instance, instances.size()
+            ));
+        }
+
+        registry.get<Transformable>(instances[instance])
+            .set_transform(at(instance, time));
+
+        while (i < keys.size() && keys[i].instance == instance) {
+            i++;
+        }
+    }
+}
@@ -0,0 +1,242 @@
+#include "bvh.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <future>
+#include <numeric>
+
+namespace {
+const uint32_t max_leaf_size = 4;
+const uint32_t max_depth = 30; // common.comp uses a stack of 32
+const uint32_t bin_count = 8;
+const uint32_t parallel_threshold = 1024; // Below this, forking costs more
+const float traversal_cost = 1.0f;
+const float rebuild_threshold = 2.0f; // Relative to the cost right after build
+} // namespace
+
+InstanceBvh::InstanceBvh() noexcept
+    : nodes(), indices(), prim_bounds(), nodes_used(0), built_cost(0.0f) {};
+
+bool InstanceBvh::update(std::span<const Aabb> bounds) {
+    if (bounds.size() != prim_bounds.size() || nodes.empty()) {
+        build(bounds);
+        return true;
+    }
+
+    if (std::equal(bounds.begin(), bounds.end(), prim_bounds.begin())) {
+        return false;
+    }
+
+    refit(bounds);
+
+    if (cost() > built_cost * rebuild_threshold) {
+        build(bounds);
+    }
+
+    return true;
+}
+
+void InstanceBvh::build(std::span<const Aabb> bounds) {
+    prim_bounds.assign(bounds.begin(), bounds.end());
+
+    indices.resize(prim_bounds.size());
+    std::iota(indices.begin(), indices.end(), 0);
+
+    nodes.clear();
+    if (prim_bounds.empty()) {
+        built_cost = 0.0f;
+        return;
+    }
+
+    nodes.resize(2 * prim_bounds.size() - 1);
+    nodes_used = 1;
+
+    nodes[0].left_first = 0;
+    nodes[0].count = prim_bounds.size();
+
+    subdivide(0, 0);
+
+    nodes.resize(nodes_used);
+    built_cost = cost();
+}
+
+void InstanceBvh::refit(std::span<const Aabb> bounds) {
+    prim_bounds.assign(bounds.begin(), bounds.end());
+
+    // Children are always allocated after their parent, so walking backwards
+    // visits them first.
+    for (auto i = nodes.size(); i-- > 0;) {
+        BvhNode& node = nodes[i];
+
+        Aabb box;
+        if (node.count > 0) {
+            box = node_bounds(node.left_first, node.count);
+        } else {
+            const BvhNode& left = nodes[node.left_first];
+            const BvhNode& right = nodes[node.left_first + 1];
+
+            box = Aabb{left.aabb_min, left.aabb_max};
+            box.grow(Aabb{right.aabb_min, right.aabb_max});
+        }
+
+        node.aabb_min = box.min;
+        node.aabb_max = box.max;
+    }
+}
+
+float InstanceBvh::cost() const noexcept {
+    if (nodes.empty()) {
+        return 0.0f;
+    }
+
+    float root_area =
+        Aabb{nodes[0].aabb_min, nodes[0].aabb_max}.surface_area();
+    if (root_area <= 0.0f) {
+        return 0.0f;
+    }
+
+    float sum = 0.0f;
+    for (auto& node : nodes) {
+        sum += Aabb{node.aabb_min, node.aabb_max}.surface_area();
+    }
+
+    return sum / root_area;
+}
+
+Aabb InstanceBvh::node_bounds(uint32_t first, uint32_t count) const noexcept {
+    Aabb box;
+    for (uint32_t i = first; i < first + count; i++) {
+        box.grow(prim_bounds[indices[i]]);
+    }
+
+    return box;
+}
+
+void InstanceBvh::subdivide(uint32_t node_index, uint32_t depth) {
+    BvhNode& node = nodes[node_index];
+    const uint32_t first = node.left_first;
+    const uint32_t count = node.count;
+
+    Aabb box = node_bounds(first, count);
+    node.aabb_min = box.min;
+    node.aabb_max = box.max;
+
+    if (count <= max_leaf_size || depth >= max_depth) {
+        return;
+    }
+
+    Aabb centroids;
+    for (uint32_t i = first; i < first + count; i++) {
+        centroids.grow(prim_bounds[indices[i]].centroid());
+    }
+
+    glm::vec3 extent = centroids.extent();
+    int axis = 0;
+    if (extent.y > extent[axis]) {
+        axis = 1;
+    }
+    if (extent.z > extent[axis]) {
+        axis = 2;
+    }
+
+    if (extent[axis] <= 0.0f) {
+        return; // Every centroid is at the same spot; Can't split
+    }
+
+    // Binned SAH along the longest centroid axis
+    std::array<Aabb, bin_count> bins{};
+    std::array<uint32_t, bin_count> bin_sizes{};
+    const float scale = float(bin_count) / extent[axis];
+
+    auto bin_of = [&](uint32_t prim) {
+        float c = prim_bounds[prim].centroid()[axis];
+        return std::min(
+            bin_count - 1, uint32_t((c - centroids.min[axis]) * scale)
+        );
+    };
+
+    for (uint32_t i = first; i < first + count; i++) {
+        uint32_t bin = bin_of(indices[i]);
+        bins[bin].grow(prim_bounds[indices[i]]);
+        bin_sizes[bin]++;
+    }
+
+    std::array<float, bin_count - 1> left_area, right_area;
+    std::array<uint32_t, bin_count - 1> left_count, right_count;
+    Aabb left_box, right_box;
+    uint32_t left_sum = 0, right_sum = 0;
+
+    for (uint32_t i = 0; i < bin_count - 1; i++) {
+        left_sum += bin_sizes[i];
+        left_box.grow(bins[i]);
+        left_count[i] = left_sum;
+        left_area[i] = left_box.surface_area();
+
+        right_sum += bin_sizes[bin_count - 1 - i];
+        right_box.grow(bins[bin_count - 1 - i]);
+        right_count[bin_count - 2 - i] = right_sum;
+        right_area[bin_count - 2 - i] = right_box.surface_area();
+    }
+
+    float best_cost = float(count); // Cost of leaving this as a leaf
+    uint32_t best_split = bin_count;
+    const float parent_area = std::max(box.surface_area(), 1e-20f);
+
+    for (uint32_t i = 0; i < bin_count - 1; i++) {
+        if (left_count[i] == 0 || right_count[i] == 0) {
+            continue;
+        }
+
+        float split_cost = traversal_cost + (left_area[i] * left_count[i] +
+                                             right_area[i] * right_count[i]) /
+                                                parent_area;
+        if (split_cost < best_cost) {
+            best_cost = split_cost;
+            best_split = i;
+        }
+    }
+
+    uint32_t left_size;
+    if (best_split < bin_count) {
+        auto middle = std::partition(
+            indices.begin() + first, indices.begin() + first + count,
+            [&](uint32_t prim) { return bin_of(prim) <= best_split; }
+        );
+        left_size = middle - (indices.begin() + first);
+    } else {
+        // SAH prefers a leaf, but the leaf would be too large for the shader
+        // to loop over cheaply. Fall back to a median split.
+        left_size = count / 2;
+        std::nth_element(
+            indices.begin() + first, indices.begin() + first + left_size,
+            indices.begin() + first + count,
+            [&](uint32_t a, uint32_t b) {
+                return prim_bounds[a].centroid()[axis] <
+                       prim_bounds[b].centroid()[axis];
+            }
+        );
+    }
+
+    uint32_t left = nodes_used.fetch_add(2);
+    nodes[left].left_first = first;
+    nodes[left].count = left_size;
+    nodes[left + 1].left_first = first + left_size;
+    nodes[left + 1].count = count - left_size;
+
+    node.left_first = left;
+    node.count = 0;
+
+    if (left_size >= parallel_threshold &&
+        count - left_size >= parallel_threshold) {
+        auto future = std::async(std::launch::async, [this, left, depth]() {
+            subdivide(left, depth + 1);
+        });
+        subdivide(left + 1, depth + 1);
+        future.get();
+    } else {
+        subdivide(left, depth + 1);
+        subdivide(left + 1, depth + 1);
+    }
+}
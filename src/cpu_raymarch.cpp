@@ -0,0 +1,860 @@
+#include "cpu_raymarch.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+namespace {
+// The tiles [begin, end) a worker has yet to render. Both ends share one word
+// so that the owner taking from the front and thieves taking from the back
+// race on a single CAS.
+class TileQueue {
+public:
+    void assign(uint32_t begin, uint32_t end) noexcept {
+        range.store(pack(begin, end));
+    }
+
+    // By the owner
+    std::optional<uint32_t> pop() noexcept {
+        uint64_t current = range.load();
+
+        while (true) {
+            auto [begin, end] = unpack(current);
+            if (begin >= end) {
+                return std::nullopt;
+            }
+
+            if (range.compare_exchange_weak(current, pack(begin + 1, end))) {
+                return begin;
+            }
+        }
+    }
+
+    // By other workers, takes the back half
+    std::optional<std::pair<uint32_t, uint32_t>> steal() noexcept {
+        uint64_t current = range.load();
+
+        while (true) {
+            auto [begin, end] = unpack(current);
+            if (begin >= end) {
+                return std::nullopt;
+            }
+
+            uint32_t middle = end - (end - begin + 1) / 2;
+            if (range.compare_exchange_weak(current, pack(begin, middle))) {
+                return std::pair(middle, end);
+            }
+        }
+    }
+
+private:
+    static uint64_t pack(uint32_t begin, uint32_t end) noexcept {
+        return (uint64_t(begin) << 32) | end;
+    }
+
+    static std::pair<uint32_t, uint32_t> unpack(uint64_t packed) noexcept {
+        return {uint32_t(packed >> 32), uint32_t(packed)};
+    }
+
+    // Own cache line, the owner hammers it
+    alignas(64) std::atomic<uint64_t> range{0};
+};
+
+// min() and max() as GPUs implement them. GLSL leaves NaN operands undefined,
+// but hardware returns the other one, which slab_test() relies on to drop
+// the NaN of 0 * inf. std::min() and std::max() would keep it when it comes
+// first.
+float gpu_min(float a, float b) { return std::isnan(b) ? a : a < b ? a : b; }
+float gpu_max(float a, float b) { return std::isnan(b) ? a : a > b ? a : b; }
+
+glm::vec3 min3(glm::vec3 a, glm::vec3 b) {
+    return glm::vec3(gpu_min(a.x, b.x), gpu_min(a.y, b.y), gpu_min(a.z, b.z));
+}
+
+glm::vec3 max3(glm::vec3 a, glm::vec3 b) {
+    return glm::vec3(gpu_max(a.x, b.x), gpu_max(a.y, b.y), gpu_max(a.z, b.z));
+}
+
+// slab_test() of common.comp with the axes that limit either end
+glm::vec2 flat_slab_test(
+    glm::vec3 cor1, glm::vec3 cor2, glm::vec3 pos, glm::vec3 dir_inv,
+    glm::bvec3& min_hit_dir, glm::bvec3& max_hit_dir
+) {
+    const float inf = std::numeric_limits<float>::infinity();
+
+    glm::vec3 t1 = (cor1 - pos) * dir_inv;
+    glm::vec3 t2 = (cor2 - pos) * dir_inv;
+
+    glm::vec3 tminvec = min3(min3(t1, t2), glm::vec3(inf));
+    glm::vec3 tmaxvec = max3(max3(t1, t2), glm::vec3(-inf));
+
+    float tmin = gpu_max(tminvec.x, gpu_max(tminvec.y, tminvec.z));
+    float tmax = gpu_min(tmaxvec.x, gpu_min(tmaxvec.y, tmaxvec.z));
+
+    min_hit_dir = glm::equal(tminvec, glm::vec3(tmin));
+    max_hit_dir = glm::equal(tmaxvec, glm::vec3(tmax));
+
+    return glm::vec2(tmin, tmax);
+}
+
+// Negative coordinates only show up on the step that leaves the model, whose
+// bitmask is never descended
+glm::uvec3 flat_pos_to_bitmask(glm::vec3 pos, uint32_t level) {
+    return glm::uvec3(max3(pos, glm::vec3(0.0f)) * float(1u << level));
+}
+
+uint32_t flat_bitmask_to_index(glm::uvec3 bitmask, uint32_t level) {
+    if (level == 0) {
+        return 0; // Voxels have no children to pick from
+    }
+
+    glm::uvec3 bit = (bitmask >> (level - 1)) & 1u;
+    return (bit.x << 2) | (bit.y << 1) | bit.z;
+}
+
+float flat_level_size(uint32_t level, uint32_t max_level) {
+    return std::ldexp(1.0f, -int(max_level - level));
+}
+
+// findMSB(), -1 for 0
+int find_msb(uint32_t v) { return v == 0 ? -1 : std::bit_width(v) - 1; }
+
+glm::vec3 flat_voxel_start(glm::vec3 pos, uint32_t at_level, uint32_t level) {
+    return glm::floor(pos * std::ldexp(1.0f, level - at_level)) *
+           std::ldexp(1.0f, -int(level - at_level));
+}
+
+bool flat_inside(glm::vec3 pos) {
+    return glm::all(glm::lessThan(pos, glm::vec3(1.0f))) &&
+           glm::all(glm::lessThan(glm::vec3(0.0f), pos));
+}
+
+// Where a ray stands between two iterations of raymarch_model()
+typedef struct {
+    glm::vec3 pos;
+    glm::vec3 dir;
+    glm::vec3 dir_inv;
+    glm::vec3 bias;
+    glm::bvec3 limiting_axis_max;
+} FlatWalk;
+
+// The part of trace_instance() before raymarch_model(), given the slab test
+// against the model
+std::optional<FlatWalk> flat_enter(
+    const Ray& ray, uint32_t level, float bias_amt, glm::vec2 minmax,
+    glm::bvec3 limiting_axis_min
+) {
+    minmax.x = std::max(0.0f, minmax.x);
+
+    if (!(minmax.y > minmax.x)) {
+        return std::nullopt;
+    }
+
+    glm::vec3 bias = flat_level_size(0, level) * bias_amt * ray.dir;
+    glm::vec3 pos = glm::clamp(
+        ray.origin + ray.dir * minmax.x - bias, glm::vec3(0.0f),
+        glm::vec3(1.0f)
+    );
+
+    return FlatWalk{pos, ray.dir, 1.0f / ray.dir, bias, limiting_axis_min};
+}
+
+typedef struct {
+    const SerializedNode* node;
+    uint32_t at_level;
+    bool found; // Only false with a malformed tree
+} FlatDescent;
+
+// Deepest node at `pos_bitmask`, restarting from `cur_level` of a stack that
+// holds the path of an earlier descent
+FlatDescent flat_descend(
+    std::span<const SerializedNode> nodes, std::array<Addr_t, 34>& stack,
+    glm::uvec3 pos_bitmask, uint32_t cur_level
+) {
+    for (uint32_t j = cur_level;; j--) {
+        uint32_t child = flat_bitmask_to_index(pos_bitmask, j);
+        Addr_t index = nodes[stack[j + 1]].addr[child];
+        stack[j] = index;
+
+        if (index == 0) {
+            return FlatDescent{&nodes[stack[j + 1]], j, true};
+        }
+
+        if (j == 0) {
+            return FlatDescent{&nodes[0], 0, false};
+        }
+    }
+}
+
+void flat_hit(
+    FlatTraceResult& result, const FlatWalk& walk, const FlatDescent& descent
+) {
+    result.hit = true;
+    result.pos = walk.pos;
+    result.normal =
+        -glm::sign(walk.dir) * glm::vec3(walk.limiting_axis_max);
+    result.at_level = descent.at_level;
+    result.mat_id = descent.node->mat_id;
+}
+
+// Steps past the voxel of `size` that `step` is the slab test against, and
+// returns the level to restart the next descent from. A step that only
+// covers the bias can stay inside the voxel and return a level below it,
+// whose stack entry the last descent never wrote, so callers restart from
+// the voxel's level at least, as raymarch_model() does.
+uint32_t
+flat_advance(FlatWalk& walk, glm::vec2 step, float size, uint32_t level) {
+    step = glm::max(glm::vec2(0.0f), step);
+
+    glm::uvec3 pos_bitmask_prev = flat_pos_to_bitmask(walk.pos, level);
+    walk.pos += step.y * walk.dir + walk.bias +
+                glm::vec3(size) * 0.01f *
+                    (step.y == 0.0f ? glm::vec3(walk.limiting_axis_max) *
+                                          glm::sign(walk.dir)
+                                    : glm::vec3(0.0f));
+    glm::uvec3 pos_bitmask_now = flat_pos_to_bitmask(walk.pos, level);
+
+    glm::uvec3 changed = pos_bitmask_now ^ pos_bitmask_prev;
+    uint32_t lsb = uint32_t(std::clamp(
+        std::max(
+            find_msb(changed.x),
+            std::max(find_msb(changed.y), find_msb(changed.z))
+        ),
+        0, int(level)
+    ));
+
+    return std::min(lsb + 1, level);
+}
+
+// raymarch_model() of one ray, `steps` into its walk
+FlatTraceResult flat_march(
+    std::span<const SerializedNode> nodes, uint32_t level, FlatWalk walk,
+    uint32_t steps
+) {
+    FlatTraceResult result{};
+    result.steps = steps;
+
+    std::array<Addr_t, 34> stack;
+    stack[level + 1] = 0;
+    uint32_t cur_level = level;
+
+    do {
+        FlatDescent descent = flat_descend(
+            nodes, stack, flat_pos_to_bitmask(walk.pos, level), cur_level
+        );
+
+        float size = flat_level_size(descent.at_level, level);
+        glm::vec3 vox_start =
+            flat_voxel_start(walk.pos, descent.at_level, level);
+
+        result.steps++;
+
+        if (descent.node->mat_id != 0) {
+            flat_hit(result, walk, descent);
+            return result;
+        }
+
+        glm::bvec3 limiting_axis_min;
+        glm::vec2 step = flat_slab_test(
+            vox_start, vox_start + glm::vec3(size), walk.pos, walk.dir_inv,
+            limiting_axis_min, walk.limiting_axis_max
+        );
+
+        cur_level = std::max(
+            flat_advance(walk, step, size, level), descent.at_level
+        );
+    } while (flat_inside(walk.pos) && result.steps < flat_max_iters);
+
+    return result;
+}
+
+// The rays of a packet axis by axis, as SSE loads them
+typedef struct {
+    alignas(16) std::array<std::array<float, packet_size>, 3> axis;
+} PacketVec3;
+
+// flat_slab_test() of every ray of a packet against the same box
+void packet_slab_test(
+    glm::vec3 cor1, glm::vec3 cor2, const PacketVec3& pos,
+    const PacketVec3& dir_inv, std::array<glm::vec2, packet_size>& minmax,
+    std::array<glm::bvec3, packet_size>& min_hit_dir,
+    std::array<glm::bvec3, packet_size>& max_hit_dir
+) {
+#ifdef __SSE2__
+    static_assert(packet_size == 4);
+
+    // gpu_min() and gpu_max(). Both instructions return `b` when either is
+    // NaN, so only a NaN `b` needs replacing, and the lanes match the scalar
+    // test bit for bit.
+    auto keep_a_over_nan_b = [](__m128 a, __m128 b, __m128 result) {
+        __m128 nan_b = _mm_cmpunord_ps(b, b);
+        return _mm_or_ps(_mm_and_ps(nan_b, a), _mm_andnot_ps(nan_b, result));
+    };
+    auto min = [&](__m128 a, __m128 b) {
+        return keep_a_over_nan_b(a, b, _mm_min_ps(a, b));
+    };
+    auto max = [&](__m128 a, __m128 b) {
+        return keep_a_over_nan_b(a, b, _mm_max_ps(a, b));
+    };
+
+    const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    const __m128 neg_inf = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+
+    __m128 tminvec[3];
+    __m128 tmaxvec[3];
+    for (int a = 0; a < 3; a++) {
+        __m128 p = _mm_load_ps(pos.axis[a].data());
+        __m128 inv = _mm_load_ps(dir_inv.axis[a].data());
+
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(cor1[a]), p), inv);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(cor2[a]), p), inv);
+
+        tminvec[a] = min(min(t1, t2), inf);
+        tmaxvec[a] = max(max(t1, t2), neg_inf);
+    }
+
+    __m128 tmin = max(tminvec[0], max(tminvec[1], tminvec[2]));
+    __m128 tmax = min(tmaxvec[0], min(tmaxvec[1], tmaxvec[2]));
+
+    alignas(16) std::array<float, packet_size> tmins;
+    alignas(16) std::array<float, packet_size> tmaxs;
+    _mm_store_ps(tmins.data(), tmin);
+    _mm_store_ps(tmaxs.data(), tmax);
+
+    std::array<int, 3> min_hits;
+    std::array<int, 3> max_hits;
+    for (int a = 0; a < 3; a++) {
+        min_hits[a] = _mm_movemask_ps(_mm_cmpeq_ps(tminvec[a], tmin));
+        max_hits[a] = _mm_movemask_ps(_mm_cmpeq_ps(tmaxvec[a], tmax));
+    }
+
+    for (size_t r = 0; r < packet_size; r++) {
+        minmax[r] = glm::vec2(tmins[r], tmaxs[r]);
+
+        for (int a = 0; a < 3; a++) {
+            min_hit_dir[r][a] = (min_hits[a] >> r) & 1;
+            max_hit_dir[r][a] = (max_hits[a] >> r) & 1;
+        }
+    }
+#else
+    for (size_t r = 0; r < packet_size; r++) {
+        minmax[r] = flat_slab_test(
+            cor1, cor2,
+            glm::vec3(pos.axis[0][r], pos.axis[1][r], pos.axis[2][r]),
+            glm::vec3(
+                dir_inv.axis[0][r], dir_inv.axis[1][r], dir_inv.axis[2][r]
+            ),
+            min_hit_dir[r], max_hit_dir[r]
+        );
+    }
+#endif
+}
+
+std::byte to_byte(float c) {
+    return std::byte(std::clamp(int(c * 255.0f + 0.5f), 0, 255));
+}
+} // namespace
+
+std::optional<CpuHit> trace(const SvoDag& svodag, const Ray ray) {
+#ifndef NDEBUG
+    // Only for the log below, counted per thread
+    thread_local int invocation_id = 0;
+    invocation_id++;
+#endif
+
+    // This is only an example implementation
+
+    // endpoint always intersects a voxel
+
+    /*Assume that the svodag always spans (0, 0, 0) ~ (1, 1, 1)*/
+    size_t level = svodag.get_level();
+    glm::vec3 dir_inv(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+    glm::vec3 dir_sign(
+        ray.dir.x >= 0 ? 1 : -1, ray.dir.y >= 0 ? 1 : -1,
+        ray.dir.z >= 0 ? 1 : -1
+    );
+
+    auto [tmin, tmax] =
+        slab_test(glm::vec3(0.0f), glm::vec3(1.0f), ray.origin, dir_inv);
+
+    tmin = std::max(0.0f, tmin);
+
+    bool intersected = (tmax > tmin);
+
+    // If the ray is outside of the svodag,
+    if (!intersected) {
+        return std::nullopt;
+    }
+
+    // Raymarch up to the aabb of the svodag
+    glm::vec3 current_pos = ray.origin + ray.dir * tmin;
+
+    // loop:
+    // If the node is air (alpha is zero), raymarch to the end of current node
+    // End loop
+
+#ifndef NDEBUG
+    int iterations = 0;
+#endif
+
+    do {
+        // Get the deepest node that intersects the point
+        glm::vec3 bias = ray.dir * level_to_size(0, 8) * 0.01f;
+        // current_pos += bias;
+        QueryResult result =
+            svodag.query(current_pos + bias); // Without bias as first test
+
+        if (result.node->get_mat_id() != 0) {
+            return CpuHit{current_pos, result.node->get_mat_id()};
+        }
+
+        // Have to find the position of the voxel
+
+        float size = level_to_size(result.at_level, level);
+
+        // glm::vec3 biased_pos = current_pos + size*0.1f*ray.dir;
+        glm::vec3 current_voxel_start =
+            snap_pos(current_pos + bias, result.at_level, level);
+        glm::vec3 sign(
+            current_voxel_start.x == current_pos.x ? dir_sign.x : +1.f,
+            current_voxel_start.y == current_pos.y ? dir_sign.y : +1.f,
+            current_voxel_start.z == current_pos.z ? dir_sign.z : +1.f
+        );
+
+        // SPDLOG_INFO(std::format("{}", sign));
+
+        // sign = glm::vec3(1.f, 1.f, 1.f);
+
+        // assert(current_voxel_start.x == current_pos.x ||
+        // current_voxel_start.y == current_pos.y || current_voxel_start.z ==
+        // current_pos.z);
+
+        glm::vec3 current_voxel_end =
+            snap_pos_up(current_pos + bias, result.at_level, level);
+        //    current_voxel_start + glm::vec3(size) * sign;
+
+        auto [tmin, tmax] = slab_test(
+            current_voxel_start, current_voxel_end, current_pos + bias, dir_inv
+        );
+
+        // current_pos = ray.origin + tmax*ray.dir;
+        current_pos += (tmax)*ray.dir + bias;
+
+#ifndef NDEBUG
+        iterations++;
+
+        if (iterations > 10000) {
+            SPDLOG_INFO("Iter count exceeded 1000, {}", invocation_id);
+            // return glm::vec4(1.0f, 1.0f, 0.0f, 1.0f);
+        }
+#endif
+    } while (current_pos.x > 0.0f && current_pos.y > 0.0f &&
+             current_pos.z > 0.0f && current_pos.x < 1.0f &&
+             current_pos.y < 1.0f && current_pos.z < 1.0f);
+
+    return std::nullopt;
+}
+
+FlatTraceResult trace_flat(
+    std::span<const SerializedNode> nodes, uint32_t level, const Ray ray,
+    float bias_amt
+) {
+    glm::bvec3 limiting_axis_min;
+    glm::bvec3 limiting_axis_max;
+
+    glm::vec2 minmax = flat_slab_test(
+        glm::vec3(0.0f), glm::vec3(1.0f), ray.origin, 1.0f / ray.dir,
+        limiting_axis_min, limiting_axis_max
+    );
+
+    std::optional<FlatWalk> walk =
+        flat_enter(ray, level, bias_amt, minmax, limiting_axis_min);
+
+    if (!walk) {
+        return FlatTraceResult{};
+    }
+
+    return flat_march(nodes, level, *walk, 0);
+}
+
+bool trace_occupancy(
+    std::span<const OccupancyNode> nodes, uint32_t level, const Ray ray,
+    float bias_amt
+) {
+    glm::bvec3 limiting_axis_min;
+    glm::bvec3 limiting_axis_max;
+
+    glm::vec2 minmax = flat_slab_test(
+        glm::vec3(0.0f), glm::vec3(1.0f), ray.origin, 1.0f / ray.dir,
+        limiting_axis_min, limiting_axis_max
+    );
+
+    std::optional<FlatWalk> walk =
+        flat_enter(ray, level, bias_amt, minmax, limiting_axis_min);
+
+    if (!walk) {
+        return false;
+    }
+
+    std::array<Addr_t, 34> stack;
+    stack[level + 1] = 0;
+    uint32_t cur_level = level;
+    uint32_t at_level = 0;
+    uint32_t stop_level = 0;
+    uint32_t steps = 0;
+
+    do {
+        glm::uvec3 pos_bitmask = flat_pos_to_bitmask(walk->pos, level);
+
+        for (uint32_t j = cur_level; j >= 1; j--) {
+            uint32_t index = flat_bitmask_to_index(pos_bitmask, j);
+            Addr_t child = nodes[stack[j + 1]].child[index];
+            stop_level = j;
+
+            if (child == occupancy_solid) {
+                return true;
+            }
+
+            if (child == occupancy_empty) {
+                at_level = j - 1;
+                break;
+            }
+
+            if ((child & occupancy_brick) != 0) {
+                uint32_t voxel = flat_bitmask_to_index(pos_bitmask, j - 1);
+                if ((child & (1u << voxel)) != 0) {
+                    return true;
+                }
+
+                at_level = j - 2;
+                break;
+            }
+
+            stack[j] = child;
+        }
+
+        float size = flat_level_size(at_level, level);
+        glm::vec3 vox_start = flat_voxel_start(walk->pos, at_level, level);
+        glm::vec3 vox_end = vox_start + glm::vec3(size);
+
+        // The shader only looks for where the ray leaves the voxel
+        glm::vec3 target = glm::mix(
+            vox_start, vox_end, glm::greaterThan(walk->dir, glm::vec3(0.0f))
+        );
+        glm::vec3 times = (target - walk->pos) * walk->dir_inv;
+        float t = gpu_min(times.x, gpu_min(times.y, times.z));
+        walk->limiting_axis_max = glm::equal(times, glm::vec3(t));
+
+        cur_level = std::max(
+            flat_advance(*walk, glm::vec2(0.0f, t), size, level), stop_level
+        );
+
+        steps++;
+    } while (flat_inside(walk->pos) && steps < flat_max_iters);
+
+    return false;
+}
+
+std::array<FlatTraceResult, packet_size> trace_flat_packet(
+    std::span<const SerializedNode> nodes, uint32_t level,
+    std::span<const Ray, packet_size> rays, float bias_amt
+) {
+    std::array<FlatTraceResult, packet_size> results{};
+
+    PacketVec3 origins;
+    PacketVec3 dir_invs;
+    for (size_t r = 0; r < packet_size; r++) {
+        for (int a = 0; a < 3; a++) {
+            origins.axis[a][r] = rays[r].origin[a];
+            dir_invs.axis[a][r] = 1.0f / rays[r].dir[a];
+        }
+    }
+
+    std::array<glm::vec2, packet_size> minmax;
+    std::array<glm::bvec3, packet_size> limiting_axis_min;
+    std::array<glm::bvec3, packet_size> limiting_axis_max;
+
+    packet_slab_test(
+        glm::vec3(0.0f), glm::vec3(1.0f), origins, dir_invs, minmax,
+        limiting_axis_min, limiting_axis_max
+    );
+
+    std::array<FlatWalk, packet_size> walks{};
+    std::array<bool, packet_size> active;
+    for (size_t r = 0; r < packet_size; r++) {
+        std::optional<FlatWalk> walk = flat_enter(
+            rays[r], level, bias_amt, minmax[r], limiting_axis_min[r]
+        );
+
+        active[r] = walk.has_value();
+        if (walk) {
+            walks[r] = *walk;
+        }
+    }
+
+    std::array<Addr_t, 34> stack;
+    stack[level + 1] = 0;
+    uint32_t cur_level = level;
+
+    while (true) {
+        size_t lead = std::ranges::find(active, true) - active.begin();
+        if (lead == packet_size) {
+            return results;
+        }
+
+        std::array<glm::uvec3, packet_size> bitmasks{};
+        for (size_t r = 0; r < packet_size; r++) {
+            if (active[r]) {
+                bitmasks[r] = flat_pos_to_bitmask(walks[r].pos, level);
+            }
+        }
+
+        // Descends once for the lead ray. The others share its node when
+        // they took the same path and its child on their side is empty too.
+        FlatDescent descent =
+            flat_descend(nodes, stack, bitmasks[lead], cur_level);
+        uint32_t at_level = descent.at_level;
+
+        bool together = descent.found;
+        for (size_t r = 0; r < packet_size && together; r++) {
+            if (!active[r]) {
+                continue;
+            }
+
+            uint32_t child = flat_bitmask_to_index(bitmasks[r], at_level);
+            together = (bitmasks[r] >> at_level) ==
+                           (bitmasks[lead] >> at_level) &&
+                       nodes[stack[at_level + 1]].addr[child] == 0;
+        }
+
+        if (!together) {
+            break;
+        }
+
+        // Shared too, as the path above at_level is
+        float size = flat_level_size(at_level, level);
+        glm::vec3 vox_start =
+            flat_voxel_start(walks[lead].pos, at_level, level);
+
+        for (size_t r = 0; r < packet_size; r++) {
+            if (active[r]) {
+                results[r].steps++;
+            }
+        }
+
+        if (descent.node->mat_id != 0) {
+            for (size_t r = 0; r < packet_size; r++) {
+                if (active[r]) {
+                    flat_hit(results[r], walks[r], descent);
+                }
+            }
+
+            return results;
+        }
+
+        PacketVec3 positions;
+        for (size_t r = 0; r < packet_size; r++) {
+            for (int a = 0; a < 3; a++) {
+                positions.axis[a][r] = walks[r].pos[a];
+            }
+        }
+
+        packet_slab_test(
+            vox_start, vox_start + glm::vec3(size), positions, dir_invs,
+            minmax, limiting_axis_min, limiting_axis_max
+        );
+
+        // Restarting higher than a ray needs still finds its node
+        cur_level = 0;
+        for (size_t r = 0; r < packet_size; r++) {
+            if (!active[r]) {
+                continue;
+            }
+
+            walks[r].limiting_axis_max = limiting_axis_max[r];
+            uint32_t restart = std::max(
+                flat_advance(walks[r], minmax[r], size, level), at_level
+            );
+
+            if (!flat_inside(walks[r].pos) ||
+                results[r].steps >= flat_max_iters) {
+                active[r] = false;
+            }
+            cur_level = std::max(cur_level, restart);
+        }
+    }
+
+    // The rays parted, each finishes on its own
+    for (size_t r = 0; r < packet_size; r++) {
+        if (active[r]) {
+            results[r] = flat_march(nodes, level, walks[r], results[r].steps);
+        }
+    }
+
+    return results;
+}
+
+glm::vec4 /*Voxel Color*/
+raymarch(const SvoDag& svodag, const Ray ray) {
+    // STUB
+    return trace(svodag, ray) ? glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)
+                              : glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+void render_cpu(
+    const CpuCamera& camera, std::span<const CpuInstance> instances, int width,
+    int height, std::span<std::array<std::byte, 4>> image, ThreadPool& pool,
+    int tile_size
+) {
+    // Instances of the same tree share its serialized nodes
+    std::vector<glm::mat4> inv_transforms;
+    std::vector<std::vector<SerializedNode>> models;
+    std::vector<size_t> instance_models;
+    std::unordered_map<const SvoDag*, size_t> model_ids;
+    for (auto& instance : instances) {
+        inv_transforms.push_back(glm::inverse(instance.transform));
+
+        auto [id, inserted] =
+            model_ids.try_emplace(instance.svodag, models.size());
+        if (inserted) {
+            models.push_back(instance.svodag->serialize());
+        }
+
+        instance_models.push_back(id->second);
+    }
+
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    uint32_t tile_count = tiles_x * tiles_y;
+
+    auto render_tile = [&](uint32_t tile) {
+        int x0 = (tile % tiles_x) * tile_size;
+        int y0 = (tile / tiles_x) * tile_size;
+        int x1 = std::min(x0 + tile_size, width);
+        int y1 = std::min(y0 + tile_size, height);
+
+        // 2x2 pixels per packet. Lanes past the edge of the tile repeat the
+        // pixel at the corner and are dropped.
+        for (int y = y0; y < y1; y += 2) {
+            for (int x = x0; x < x1; x += 2) {
+                std::array<glm::ivec2, packet_size> pixels;
+                std::array<glm::vec3, packet_size> dirs;
+                for (size_t r = 0; r < packet_size; r++) {
+                    pixels[r] = glm::ivec2(x + r % 2, y + r / 2);
+                    if (pixels[r].x >= x1 || pixels[r].y >= y1) {
+                        pixels[r] = glm::ivec2(x, y);
+                    }
+
+                    glm::vec2 frag(
+                        (pixels[r].x + 0.5f) / width * 2.0f - 1.0f,
+                        1.0f - (pixels[r].y + 0.5f) / height * 2.0f
+                    );
+                    dirs[r] = glm::normalize(
+                        camera.dir + frag.x * camera.right + frag.y * camera.up
+                    );
+                }
+
+                std::array<float, packet_size> nearest;
+                nearest.fill(std::numeric_limits<float>::infinity());
+                std::array<glm::vec4, packet_size> colors;
+                colors.fill(glm::vec4(0.0f));
+
+                for (size_t i = 0; i < instances.size(); i++) {
+                    glm::vec3 origin =
+                        inv_transforms[i] * glm::vec4(camera.pos, 1.0f);
+
+                    std::array<Ray, packet_size> rays;
+                    for (size_t r = 0; r < packet_size; r++) {
+                        rays[r] = Ray{
+                            origin, glm::normalize(glm::vec3(
+                                        inv_transforms[i] *
+                                        glm::vec4(dirs[r], 0.0f)
+                                    ))
+                        };
+                    }
+
+                    auto hits = trace_flat_packet(
+                        models[instance_models[i]],
+                        instances[i].svodag->get_level(), rays
+                    );
+
+                    for (size_t r = 0; r < packet_size; r++) {
+                        if (!hits[r].hit) {
+                            continue;
+                        }
+
+                        glm::vec3 world_pos = instances[i].transform *
+                                              glm::vec4(hits[r].pos, 1.0f);
+                        float distance = glm::length(world_pos - camera.pos);
+
+                        // STUB, like raymarch()
+                        if (distance < nearest[r]) {
+                            nearest[r] = distance;
+                            colors[r] = glm::vec4(1.0f);
+                        }
+                    }
+                }
+
+                // Backwards, so that a repeated corner keeps its own lane
+                for (size_t r = packet_size; r-- > 0;) {
+                    glm::vec4 color = colors[r];
+                    image[pixels[r].y * width + pixels[r].x] = {
+                        to_byte(color.r), to_byte(color.g), to_byte(color.b),
+                        to_byte(color.a)
+                    };
+                }
+            }
+        }
+    };
+
+    // Every worker starts on an even share of consecutive tiles, which keeps
+    // neighbouring rays on the same thread
+    size_t workers = std::max<size_t>(pool.size(), 1);
+    std::vector<TileQueue> queues(workers);
+    for (size_t w = 0; w < workers; w++) {
+        queues[w].assign(
+            tile_count * w / workers, tile_count * (w + 1) / workers
+        );
+    }
+
+    std::vector<std::future<void>> done;
+    for (size_t w = 0; w < workers; w++) {
+        done.push_back(pool.submit([&, w]() {
+            while (true) {
+                while (auto tile = queues[w].pop()) {
+                    render_tile(*tile);
+                }
+
+                // Tiles only ever move between queues, so once a full round
+                // of stealing comes up empty there is nothing left to do
+                bool stolen = false;
+                for (size_t v = 1; v < workers && !stolen; v++) {
+                    if (auto range = queues[(w + v) % workers].steal()) {
+                        queues[w].assign(range->first, range->second);
+                        stolen = true;
+                    }
+                }
+
+                if (!stolen) {
+                    return;
+                }
+            }
+        }));
+    }
+
+    for (auto& future : done) {
+        future.get();
+    }
+}
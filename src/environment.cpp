@@ -0,0 +1,137 @@
+#include "environment.hpp"
+#include "common.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+// Keeps every texel reachable so that the sampled pdf never drops to zero
+// where the skybox is merely dark.
+const float min_relative_weight = 1e-3f;
+
+std::vector<float> face_weights(
+    std::span<const std::byte> face, int width, int resolution,
+    const std::array<float, 256>& to_linear
+) {
+    std::vector<float> weights(resolution * resolution);
+    const float texel_size = 2.0f / float(resolution);
+
+    for (int y = 0; y < resolution; y++) {
+        for (int x = 0; x < resolution; x++) {
+            int x0 = x * width / resolution, x1 = (x + 1) * width / resolution;
+            int y0 = y * width / resolution, y1 = (y + 1) * width / resolution;
+
+            float luminance = 0.0f;
+            for (int j = y0; j < y1; j++) {
+                for (int i = x0; i < x1; i++) {
+                    const std::byte* texel = &face[(j * width + i) * 4];
+
+                    luminance += 0.2126f * to_linear[size_t(texel[0])] +
+                                 0.7152f * to_linear[size_t(texel[1])] +
+                                 0.0722f * to_linear[size_t(texel[2])];
+                }
+            }
+            luminance /= float((x1 - x0) * (y1 - y0));
+
+            // Solid angle of the texel, taken at its center
+            float s = (float(x) + 0.5f) * texel_size - 1.0f;
+            float t = (float(y) + 0.5f) * texel_size - 1.0f;
+            float r2 = 1.0f + s * s + t * t;
+            float solid_angle = texel_size * texel_size / (r2 * std::sqrt(r2));
+
+            weights[y * resolution + x] = luminance * solid_angle;
+        }
+    }
+
+    return weights;
+}
+} // namespace
+
+std::vector<AliasEntry> build_alias_table(std::span<const float> weights) {
+    const size_t n = weights.size();
+    const double sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+    if (n == 0 || !(sum > 0.0)) {
+        SPDLOG_CRITICAL("Cannot build an alias table out of zero weights");
+        throw std::runtime_error(
+            "Cannot build an alias table out of zero weights"
+        );
+    }
+
+    std::vector<AliasEntry> table(n);
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+
+    for (size_t i = 0; i < n; i++) {
+        table[i].probability = float(weights[i] / sum);
+        table[i].alias = i;
+        scaled[i] = weights[i] / sum * double(n);
+
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back();
+        small.pop_back();
+        uint32_t l = large.back();
+
+        table[s].threshold = float(scaled[s]);
+        table[s].alias = l;
+
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Whatever is left is 1 up to rounding errors
+    for (uint32_t i : small) {
+        table[i].threshold = 1.0f;
+    }
+    for (uint32_t i : large) {
+        table[i].threshold = 1.0f;
+    }
+
+    return table;
+}
+
+std::vector<float> environment_weights(
+    const std::array<std::span<const std::byte>, 6>& faces, int width
+) {
+    const int resolution = std::min(width, environment_resolution);
+
+    std::array<float, 256> to_linear;
+    for (int i = 0; i < 256; i++) {
+        to_linear[i] = srgb_to_linear(float(i) / 255.0f);
+    }
+
+    std::array<std::future<std::vector<float>>, 6> futures;
+    for (int i = 0; i < 6; i++) {
+        futures[i] = std::async(std::launch::async, [&, i]() {
+            return face_weights(faces[i], width, resolution, to_linear);
+        });
+    }
+
+    std::vector<float> weights;
+    weights.reserve(6 * resolution * resolution);
+    for (auto& future : futures) {
+        auto face = future.get();
+        weights.insert(weights.end(), face.begin(), face.end());
+    }
+
+    float floor = min_relative_weight *
+                  std::accumulate(weights.begin(), weights.end(), 0.0f) /
+                  float(weights.size());
+    for (auto& weight : weights) {
+        // Also covers a completely black skybox
+        weight = std::max(weight, std::max(floor, 1e-20f));
+    }
+
+    return weights;
+}
@@ -0,0 +1,67 @@
+#include "framebuffer.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <stdexcept>
+
+using namespace gl;
+
+Framebuffer::Framebuffer() noexcept : framebuffer(0) {}
+
+Framebuffer::Framebuffer(const Texture2D& color_attachment) {
+    glCreateFramebuffers(1, &framebuffer);
+    glNamedFramebufferTexture(
+        framebuffer, GL_COLOR_ATTACHMENT0, color_attachment.get(), 0
+    );
+
+    check_complete();
+}
+
+Framebuffer::Framebuffer(
+    const Texture2D& color_attachment, const Texture2D& depth_attachment
+) {
+    glCreateFramebuffers(1, &framebuffer);
+    glNamedFramebufferTexture(
+        framebuffer, GL_COLOR_ATTACHMENT0, color_attachment.get(), 0
+    );
+    glNamedFramebufferTexture(
+        framebuffer, GL_DEPTH_ATTACHMENT, depth_attachment.get(), 0
+    );
+
+    check_complete();
+}
+
+void Framebuffer::check_complete() const {
+    GLenum status = glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        SPDLOG_CRITICAL(
+            "Framebuffer is incomplete: {}", static_cast<int>(status)
+        );
+        throw std::runtime_error("Framebuffer is incomplete");
+    }
+}
+
+Framebuffer::~Framebuffer() noexcept { glDeleteFramebuffers(1, &framebuffer); }
+
+Framebuffer::Framebuffer(Framebuffer&& other) noexcept
+    : framebuffer(other.framebuffer) {
+    other.framebuffer = 0;
+}
+
+Framebuffer& Framebuffer::operator=(Framebuffer&& other) noexcept {
+    using std::swap;
+
+    swap(framebuffer, other.framebuffer);
+
+    return *this;
+}
+
+void Framebuffer::bind() const noexcept {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void Framebuffer::bind_default() noexcept {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+gl::GLuint Framebuffer::get() const noexcept { return framebuffer; }
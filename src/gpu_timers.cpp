@@ -0,0 +1,238 @@
+#include "gpu_timers.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+using namespace gl;
+
+namespace {
+// Nearest rank of a sorted, non-empty list
+double percentile(const std::vector<float>& sorted, double p) {
+    size_t rank = size_t(std::ceil(p / 100.0 * sorted.size()));
+
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+} // namespace
+
+GpuTimers::GpuTimers(std::vector<std::string> pass_names, size_t history_size)
+    : names(std::move(pass_names)), frame(0), active(no_pass),
+      history_size(history_size), next_record(0) {
+    names.push_back("Total");
+
+    queries.resize(latency * pass_count());
+    issued.resize(queries.size(), false);
+    glGenQueries(queries.size(), queries.data());
+}
+
+GpuTimers::~GpuTimers() noexcept {
+    glDeleteQueries(queries.size(), queries.data());
+}
+
+GpuTimers::GpuTimers(GpuTimers&& other) noexcept
+    : names(std::move(other.names)), queries(std::move(other.queries)),
+      issued(std::move(other.issued)), frame(other.frame),
+      active(other.active), history(std::move(other.history)),
+      history_size(other.history_size), next_record(other.next_record) {
+    other.queries.clear();
+}
+
+GpuTimers& GpuTimers::operator=(GpuTimers&& other) noexcept {
+    using std::swap;
+
+    swap(names, other.names);
+    swap(queries, other.queries);
+    swap(issued, other.issued);
+    swap(frame, other.frame);
+    swap(active, other.active);
+    swap(history, other.history);
+    swap(history_size, other.history_size);
+    swap(next_record, other.next_record);
+
+    return *this;
+}
+
+void GpuTimers::begin_frame() {
+    if (active != no_pass) {
+        SPDLOG_WARN(
+            "{} was still being timed at the end of a frame", name(active)
+        );
+        end();
+    }
+
+    frame++;
+    size_t slot = (frame % latency) * pass_count();
+
+    std::vector<float> record(
+        pass_count() + 1, std::numeric_limits<float>::quiet_NaN()
+    );
+    bool any = false;
+    bool complete = true;
+
+    for (size_t pass = 0; pass < pass_count(); pass++) {
+        if (!issued[slot + pass]) {
+            continue;
+        }
+        issued[slot + pass] = false;
+
+        GLuint available = 0;
+        glGetQueryObjectuiv(
+            queries[slot + pass], GL_QUERY_RESULT_AVAILABLE, &available
+        );
+
+        // Only when the GPU is more than `latency` frames behind
+        if (!available) {
+            complete = false;
+            continue;
+        }
+
+        GLuint64 elapsed_ns;
+        glGetQueryObjectui64v(
+            queries[slot + pass], GL_QUERY_RESULT, &elapsed_ns
+        );
+
+        record[pass] = float(elapsed_ns) * 1e-6f;
+        any = true;
+    }
+
+    if (!any) {
+        return;
+    }
+
+    if (complete) {
+        record.back() = 0.0f;
+        for (size_t pass = 0; pass < pass_count(); pass++) {
+            record.back() += std::isnan(record[pass]) ? 0.0f : record[pass];
+        }
+    }
+
+    if (history.size() < history_size) {
+        history.push_back(std::move(record));
+    } else {
+        history[next_record] = std::move(record);
+    }
+    next_record = (next_record + 1) % history_size;
+}
+
+void GpuTimers::begin(size_t pass) {
+    // Nothing to time with a default constructed GpuTimers
+    if (pass >= pass_count()) {
+        return;
+    }
+
+    size_t query = (frame % latency) * pass_count() + pass;
+
+    if (active != no_pass || issued[query]) {
+        return;
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, queries[query]);
+    issued[query] = true;
+    active = pass;
+}
+
+void GpuTimers::end() {
+    if (active == no_pass) {
+        return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    active = no_pass;
+}
+
+void GpuTimers::clear() {
+    history.clear();
+    next_record = 0;
+}
+
+void GpuTimers::flush() {
+    glFinish();
+
+    // Each call collects the oldest slot
+    for (size_t i = 0; i < latency; i++) {
+        begin_frame();
+    }
+}
+
+std::vector<float> GpuTimers::samples(size_t pass) const {
+    std::vector<float> result;
+    result.reserve(history.size());
+
+    for (auto& record : history) {
+        if (!std::isnan(record[pass])) {
+            result.push_back(record[pass]);
+        }
+    }
+
+    return result;
+}
+
+GpuTimers::Stats GpuTimers::stats(size_t pass) const {
+    std::vector<float> sorted = samples(pass);
+
+    if (sorted.empty()) {
+        return Stats{0, 0.0, 0.0, 0.0, 0.0};
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+
+    return Stats{
+        sorted.size(),
+        std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size(),
+        percentile(sorted, 50.0), percentile(sorted, 95.0),
+        percentile(sorted, 99.0)
+    };
+}
+
+void GpuTimers::write_csv(const std::filesystem::path& path) const {
+    std::ofstream file(path);
+
+    file << "frame";
+    for (auto& name : names) {
+        file << ',' << name;
+    }
+    file << '\n';
+
+    // Oldest first
+    size_t first = history.size() < history_size ? 0 : next_record;
+    for (size_t i = 0; i < history.size(); i++) {
+        auto& record = history[(first + i) % history.size()];
+
+        file << i;
+        for (float ms : record) {
+            file << ',';
+            if (!std::isnan(ms)) {
+                file << ms;
+            }
+        }
+        file << '\n';
+    }
+
+    if (!file) {
+        SPDLOG_ERROR("Could not write {}", path.string());
+    }
+}
+
+void GpuTimers::write_json(const std::filesystem::path& path) const {
+    std::ofstream file(path);
+
+    file << "{\n";
+    for (size_t pass = 0; pass < names.size(); pass++) {
+        Stats s = stats(pass);
+
+        file << "  \"" << names[pass] << "\": {\"samples\": " << s.samples
+             << ", \"average_ms\": " << s.average << ", \"p50_ms\": " << s.p50
+             << ", \"p95_ms\": " << s.p95 << ", \"p99_ms\": " << s.p99 << "}"
+             << (pass + 1 < names.size() ? ",\n" : "\n");
+    }
+    file << "}\n";
+
+    if (!file) {
+        SPDLOG_ERROR("Could not write {}", path.string());
+    }
+}
@@ -1,3 +1,4 @@
+#include "benchmark.hpp"
 #include "common.hpp"
 #include "components.hpp"
 #include "formatter.hpp"
@@ -27,31 +28,163 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <algorithm>
 #include <filesystem>
 #include <format>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <span>
 #include <string>
+#include <vector>
 
 using namespace gl;
 using namespace glm;
 
+// Replays the scripted camera and transforms on a fixed clock with fixed
+// seeds, then writes the timings and captured frames to options.output_dir
+int run_headless(
+    Renderer& renderer, entt::registry& registry,
+    std::span<const entt::entity> instances, const BenchmarkOptions& options
+) {
+    CameraPath camera_path;
+    TransformTimeline timeline;
+    std::vector<double> frame_times;
+
+    auto capture = [&](const std::filesystem::path& path) {
+        std::vector<std::byte> image = renderer.read_image();
+
+        if (!stbi_write_png(
+                path.c_str(), options.width, options.height, 4, image.data(),
+                options.width * 4
+            )) {
+            SPDLOG_ERROR("Could not write {}", path.string());
+        }
+    };
+
+    try {
+        if (!options.camera_path.empty()) {
+            camera_path = CameraPath::load(options.camera_path);
+        }
+        if (!options.timeline.empty()) {
+            timeline = TransformTimeline::load(options.timeline);
+        }
+        std::filesystem::create_directories(options.output_dir);
+
+        double prev_time = glfwGetTime();
+        for (int frame = 0; frame < options.warmup_frames + options.frames;
+             frame++) {
+            // The warmup holds the start of the script while shaders compile
+            int measured = frame - options.warmup_frames;
+            float time = std::max(measured, 0) * options.frame_time;
+
+            if (measured == 0) {
+                renderer.get_gpu_timers().clear();
+            }
+
+            renderer.set_seed(options.seed + frame);
+            if (!timeline.empty()) {
+                timeline.apply(time, instances, registry);
+            }
+
+            renderer.main_loop(registry, [&](Window&, Camera& camera) {
+                if (!camera_path.empty()) {
+                    CameraKey key = camera_path.at(time);
+                    camera.set_pos(key.pos);
+                    camera.set_dir(key.pitch, key.yaw);
+                }
+
+                camera.set_aspect((float)options.width / options.height);
+            });
+
+            double now = glfwGetTime();
+            if (measured >= 0) {
+                frame_times.push_back((now - prev_time) * 1000.0);
+            }
+            prev_time = now;
+
+            if (measured >= 0 && options.capture_every > 0 &&
+                measured % options.capture_every == 0) {
+                capture(
+                    options.output_dir /
+                    std::format("frame_{:05}.png", measured)
+                );
+            }
+        }
+    } catch (const std::exception& e) {
+        SPDLOG_CRITICAL("{}", e.what());
+        return 1;
+    }
+
+    capture(options.output_dir / "final.png");
+
+    GpuTimers& timers = renderer.get_gpu_timers();
+    timers.flush();
+    timers.write_csv(options.output_dir / "gpu_timings.csv");
+    timers.write_json(options.output_dir / "gpu_timings.json");
+
+    // Wall time between main_loop() returns, which includes waiting on the
+    // GPU once the driver queue is full
+    std::ofstream cpu_file(options.output_dir / "cpu_frame_times.csv");
+    cpu_file << "frame,ms\n";
+    for (size_t i = 0; i < frame_times.size(); i++) {
+        cpu_file << std::format("{},{}\n", i, frame_times[i]);
+    }
+
+    GpuTimers::Stats total = timers.stats(timers.pass_count());
+    SPDLOG_INFO(
+        "{} frames, GPU total avg {:.3f} ms, p50 {:.3f}, p95 {:.3f}, "
+        "p99 {:.3f}",
+        total.samples, total.average, total.p50, total.p95, total.p99
+    );
+
+    return 0;
+}
+
 int main(int argc, char** argv) {
     spdlog::set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%l] [%@] %v");
 
+    BenchmarkOptions options;
+    try {
+        options = parse_options(std::span<char* const>(argv, argc));
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << '\n' << usage();
+        return 1;
+    }
+
     SPDLOG_INFO("Program Started");
 
+    if (options.surfaceless) {
+#if GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 4
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+        SPDLOG_WARN("Surfaceless rendering needs GLFW 3.4, using a hidden "
+                    "window instead");
+#endif
+    }
+
     glfwInit();
 
-    const GLFWvidmode* vidmode = glfwGetVideoMode(glfwGetPrimaryMonitor());
-    float xscale, yscale;
-    glfwGetMonitorContentScale(glfwGetPrimaryMonitor(), &xscale, &yscale);
+    if (options.surfaceless) {
+#if GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 4
+        // The null platform has no native contexts, while Mesa's EGL can
+        // render without any surface, even on llvmpipe
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#endif
+    }
 
-    SPDLOG_INFO("Content scale x: {}, y: {}", xscale, yscale);
+    if (!options.headless) {
+        float xscale, yscale;
+        glfwGetMonitorContentScale(glfwGetPrimaryMonitor(), &xscale, &yscale);
 
-    Renderer renderer(static_cast<int>(1920), static_cast<int>(1080));
+        SPDLOG_INFO("Content scale x: {}, y: {}", xscale, yscale);
+    }
 
-    renderer.use_cubemap(
-        {"res/right.jpg", "res/left.jpg", "res/top.jpg", "res/bottom.jpg",
-         "res/front.jpg", "res/back.jpg"}
+    Renderer renderer(
+        options.width, options.height, !options.headless, !options.surfaceless
     );
 
     entt::registry registry;
@@ -59,36 +192,55 @@ int main(int argc, char** argv) {
     SPDLOG_INFO("Creating matid list");
     MatID_t white = renderer.register_material({glm::vec4(1.0, 1.0, 1.0, 1.0)});
 
-    SPDLOG_INFO("Creating SVODAG");
-
-    size_t depth = 6;
-    SvoDag svodag{depth}; // width = 256;
-
-    long limit = 1 << depth;
-    for (long x = 0; x < limit; x++) {
-        for (long y = 0; y < limit; y++) {
-            for (long z = 0; z < limit; z++) {
-                long length = (x - (limit >> 1)) * (x - (limit >> 1)) +
-                              (y - (limit >> 1)) * (y - (limit >> 1)) +
-                              (z - (limit >> 1)) * (z - (limit >> 1));
-                if ((limit >> 1) * (limit >> 2) < length &&
-                    length <= (limit >> 1) * (limit >> 1))
-                // if (x == 2)
-                {
-                    svodag.insert(x, y, z, white);
+    // Building the DAG does not touch GL, so it overlaps with the skybox upload
+    // below and the shader compiles the renderer has issued
+    std::future<SvoDag> dag = std::async(std::launch::async, [white]() {
+        SPDLOG_INFO("Creating SVODAG");
+
+        size_t depth = 6;
+        SvoDag svodag{depth}; // width = 256;
+
+        long limit = 1 << depth;
+        for (long x = 0; x < limit; x++) {
+            for (long y = 0; y < limit; y++) {
+                for (long z = 0; z < limit; z++) {
+                    long length = (x - (limit >> 1)) * (x - (limit >> 1)) +
+                                  (y - (limit >> 1)) * (y - (limit >> 1)) +
+                                  (z - (limit >> 1)) * (z - (limit >> 1));
+                    if ((limit >> 1) * (limit >> 2) < length &&
+                        length <= (limit >> 1) * (limit >> 1))
+                    // if (x == 2)
+                    {
+                        svodag.insert(x, y, z, white);
+                    }
                 }
             }
         }
-    }
-    SPDLOG_INFO("Created SVODAG");
+        SPDLOG_INFO("Created SVODAG");
+
+        // SPDLOG_INFO("Before: {}", svodag.serialize().size());
+        svodag.dedup();
 
-    // SPDLOG_INFO("Before: {}", svodag.serialize().size());
-    svodag.dedup();
+        return svodag;
+    });
+
+    renderer.use_cubemap(
+        {"res/right.jpg", "res/left.jpg", "res/top.jpg", "res/bottom.jpg",
+         "res/front.jpg", "res/back.jpg"}
+    );
+
+    SvoDag svodag = dag.get();
 
     std::vector<SerializedNode> data = svodag.serialize();
 
-    size_t model1 = renderer.register_model(data, svodag.get_level());
+    std::vector<OccupancyNode> occupancy = svodag.serialize_occupancy();
+
+    size_t model1 =
+        renderer.register_model(data, occupancy, svodag.get_level());
     SPDLOG_INFO("After: {}", data.size());
+    SPDLOG_INFO("Occupancy nodes: {}", occupancy.size());
+
+    renderer.register_mesh_source(model1, svodag);
 
     SPDLOG_INFO("Serialized SVODAG");
 
@@ -99,6 +251,7 @@ int main(int argc, char** argv) {
                 // 1000 balls
 
                 auto ball = registry.create();
+                balls.push_back(ball);
                 registry.emplace<Renderable>(ball, model1, svodag.get_level());
                 registry.emplace<Transformable>(
                     ball,
@@ -113,6 +266,13 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (options.headless) {
+        int status = run_headless(renderer, registry, balls, options);
+        glfwTerminate();
+
+        return status;
+    }
+
     bool grabbed = false;
     auto prev_escape_state = GLFW_RELEASE;
 
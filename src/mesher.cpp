@@ -0,0 +1,253 @@
+#include "mesher.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+// The subtree of a chunk, then those of its neighbours along -x, +x, -y, +y,
+// -z and +z
+typedef std::array<const SvoNode*, 7> ChunkKey;
+
+struct ChunkKeyHash {
+    size_t operator()(const ChunkKey& key) const noexcept {
+        size_t hash = 0;
+        for (auto node : key) {
+            hash = (hash << 1) ^ std::hash<const SvoNode*>{}(node);
+        }
+
+        return hash;
+    }
+};
+
+// Same order as the faces of MeshQuad
+const std::array<glm::ivec3, 6> face_steps = {
+    glm::ivec3(-1, 0, 0), glm::ivec3(1, 0, 0),  glm::ivec3(0, -1, 0),
+    glm::ivec3(0, 1, 0),  glm::ivec3(0, 0, -1), glm::ivec3(0, 0, 1)
+};
+
+// The node spanning the chunk at chunk_level, or the uniform node above it.
+// nullptr outside the tree.
+const SvoNode* chunk_node(
+    const SvoDag& svodag, size_t chunk_level, const glm::ivec3 chunk
+) {
+    int64_t chunks = int64_t(1) << (svodag.get_level() - chunk_level);
+    for (int i = 0; i < 3; i++) {
+        if (chunk[i] < 0 || chunk[i] >= chunks) {
+            return nullptr;
+        }
+    }
+
+    const SvoNode* node = svodag.get_root();
+    for (size_t level = svodag.get_level();
+         level > chunk_level && node->get_child(0); level--) {
+        size_t bit = level - 1 - chunk_level;
+        node = node->get_child(
+            (((chunk.x >> bit) & 1) << 2) | (((chunk.y >> bit) & 1) << 1) |
+            ((chunk.z >> bit) & 1)
+        );
+    }
+
+    return node;
+}
+
+// Chunks that may hold exposed faces. Of uniform solid nodes above the
+// chunk level only the outermost chunks can.
+void collect_chunks(
+    const SvoNode* node, const glm::ivec3 chunk, size_t level,
+    size_t chunk_level, std::vector<glm::ivec3>& out
+) {
+    int span = 1 << (level - chunk_level);
+
+    if (level > chunk_level && node->get_child(0)) {
+        for (size_t i = 0; i < 8; i++) {
+            glm::ivec3 offset((i >> 2) & 1, (i >> 1) & 1, i & 1);
+            collect_chunks(
+                node->get_child(i), chunk + offset * (span / 2), level - 1,
+                chunk_level, out
+            );
+        }
+
+        return;
+    }
+
+    if (!node->get_child(0) && node->get_mat_id() == 0) {
+        return;
+    }
+
+    for (int x = 0; x < span; x++) {
+        for (int y = 0; y < span; y++) {
+            for (int z = 0; z < span; z++) {
+                bool outer = x == 0 || y == 0 || z == 0 || x == span - 1 ||
+                             y == span - 1 || z == span - 1;
+                if (outer) {
+                    out.push_back(chunk + glm::ivec3(x, y, z));
+                }
+            }
+        }
+    }
+}
+
+// Quads of the chunk of edge `edge` at `origin`, relative to origin
+std::vector<MeshQuad>
+mesh_chunk(const SvoDag& svodag, const glm::uvec3 origin, uint32_t edge) {
+    // The chunk and the voxels around it, with 0 outside the tree
+    glm::uvec3 low = glm::max(origin, glm::uvec3(1u)) - glm::uvec3(1u);
+    VoxelBox box{low, origin + glm::uvec3(edge + 1)};
+    glm::ivec3 size = glm::ivec3(box.max - box.min);
+
+    std::vector<MatID_t> dense(size_t(size.x) * size.y * size.z);
+    svodag.extract(box, dense);
+
+    // p is relative to origin, from -1 to edge on every axis
+    auto at = [&](const glm::ivec3 p) -> MatID_t {
+        glm::ivec3 q = glm::ivec3(origin) - glm::ivec3(low) + p;
+        if (q.x < 0 || q.y < 0 || q.z < 0) {
+            return 0;
+        }
+
+        return dense[(size_t(q.z) * size.y + q.y) * size.x + q.x];
+    };
+
+    std::vector<MeshQuad> quads;
+    std::vector<MatID_t> mask(size_t(edge) * edge);
+
+    for (uint32_t face = 0; face < 6; face++) {
+        int axis = face / 2;
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+
+        for (uint32_t d = 0; d < edge; d++) {
+            // Materials of the faces of this layer that face empty voxels
+            for (uint32_t j = 0; j < edge; j++) {
+                for (uint32_t i = 0; i < edge; i++) {
+                    glm::ivec3 p(0);
+                    p[axis] = d;
+                    p[u] = i;
+                    p[v] = j;
+
+                    MatID_t mat_id = at(p);
+                    mask[j * edge + i] =
+                        mat_id != 0 && at(p + face_steps[face]) == 0 ? mat_id
+                                                                     : 0;
+                }
+            }
+
+            // Grows each rectangle along u first, then along v while whole
+            // rows of it match
+            for (uint32_t j = 0; j < edge; j++) {
+                for (uint32_t i = 0; i < edge;) {
+                    MatID_t mat_id = mask[j * edge + i];
+                    if (mat_id == 0) {
+                        i++;
+                        continue;
+                    }
+
+                    uint32_t width = 1;
+                    while (i + width < edge &&
+                           mask[j * edge + i + width] == mat_id) {
+                        width++;
+                    }
+
+                    uint32_t height = 1;
+                    while (j + height < edge &&
+                           std::all_of(
+                               mask.begin() + (j + height) * edge + i,
+                               mask.begin() + (j + height) * edge + i + width,
+                               [&](MatID_t m) { return m == mat_id; }
+                           )) {
+                        height++;
+                    }
+
+                    for (uint32_t h = 0; h < height; h++) {
+                        std::fill_n(
+                            mask.begin() + (j + h) * edge + i, width, 0
+                        );
+                    }
+
+                    std::array<uint32_t, 3> corner{};
+                    corner[axis] = d + face % 2;
+                    corner[u] = i;
+                    corner[v] = j;
+                    quads.push_back(
+                        MeshQuad{corner, width, height, face, mat_id}
+                    );
+
+                    i += width;
+                }
+            }
+        }
+    }
+
+    return quads;
+}
+} // namespace
+
+std::vector<MeshQuad> mesh_greedy(const SvoDag& svodag, ThreadPool* pool) {
+    size_t chunk_level = std::min(mesh_chunk_level, svodag.get_level());
+    uint32_t edge = 1u << chunk_level;
+
+    std::vector<glm::ivec3> chunks;
+    collect_chunks(
+        svodag.get_root(), glm::ivec3(0), svodag.get_level(), chunk_level,
+        chunks
+    );
+
+    // Chunks with the same key get the same quads
+    std::unordered_map<ChunkKey, size_t, ChunkKeyHash> mesh_ids;
+    std::vector<glm::ivec3> first_chunks;
+    std::vector<size_t> chunk_mesh_ids;
+    for (auto& chunk : chunks) {
+        ChunkKey key;
+        key[0] = chunk_node(svodag, chunk_level, chunk);
+        for (size_t face = 0; face < 6; face++) {
+            key[face + 1] =
+                chunk_node(svodag, chunk_level, chunk + face_steps[face]);
+        }
+
+        auto [id, inserted] = mesh_ids.try_emplace(key, first_chunks.size());
+        if (inserted) {
+            first_chunks.push_back(chunk);
+        }
+
+        chunk_mesh_ids.push_back(id->second);
+    }
+
+    std::vector<std::vector<MeshQuad>> meshes(first_chunks.size());
+    auto mesh = [&](size_t id) {
+        meshes[id] =
+            mesh_chunk(svodag, glm::uvec3(first_chunks[id]) * edge, edge);
+    };
+
+    if (pool == nullptr || pool->size() == 0 || meshes.size() <= 1) {
+        for (size_t id = 0; id < meshes.size(); id++) {
+            mesh(id);
+        }
+    } else {
+        std::vector<std::future<void>> done;
+        for (size_t id = 0; id < meshes.size(); id++) {
+            done.push_back(pool->submit([&mesh, id]() { mesh(id); }));
+        }
+
+        for (auto& future : done) {
+            future.get();
+        }
+    }
+
+    std::vector<MeshQuad> quads;
+    for (size_t k = 0; k < chunks.size(); k++) {
+        glm::uvec3 origin = glm::uvec3(chunks[k]) * edge;
+
+        for (MeshQuad quad : meshes[chunk_mesh_ids[k]]) {
+            for (int i = 0; i < 3; i++) {
+                quad.origin[i] += origin[i];
+            }
+
+            quads.push_back(quad);
+        }
+    }
+
+    return quads;
+}
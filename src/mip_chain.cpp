@@ -0,0 +1,271 @@
+#include "mip_chain.hpp"
+#include "common.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+const std::array<char, 4> cache_magic = {'V', 'E', 'M', 'C'};
+const uint32_t cache_version = 1;
+
+typedef struct CacheHeader {
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+} CacheHeader;
+
+int level_size(int size, int level) { return std::max(size >> level, 1); }
+
+size_t level_offset(int width, int height, int level) {
+    size_t offset = 0;
+    for (int i = 0; i < level; i++) {
+        offset += size_t(level_size(width, i)) * level_size(height, i) * 4;
+    }
+
+    return offset;
+}
+
+std::vector<std::byte> read_bytes(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file.is_open()) {
+        SPDLOG_CRITICAL("Could not open the file {}", path.string());
+        throw std::runtime_error(
+            std::format("Could not open the file {}", path.string())
+        );
+    }
+
+    file.seekg(0, std::ios::end);
+    std::vector<std::byte> bytes(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read((char*)bytes.data(), bytes.size());
+
+    return bytes;
+}
+} // namespace
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+    : data(nullptr), length(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(
+            std::format("Could not open the file {}", path.string())
+        );
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        throw std::runtime_error(
+            std::format("Could not map the file {}", path.string())
+        );
+    }
+
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive
+
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error(
+            std::format("Could not map the file {}", path.string())
+        );
+    }
+
+    data = mapping;
+    length = info.st_size;
+}
+
+MappedFile::~MappedFile() noexcept {
+    if (data != nullptr) {
+        munmap(data, length);
+    }
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data(other.data), length(other.length) {
+    other.data = nullptr;
+    other.length = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    using std::swap;
+
+    swap(data, other.data);
+    swap(length, other.length);
+
+    return *this;
+}
+
+MipChain MipChain::load(
+    const std::filesystem::path& path, const std::filesystem::path& cache_dir
+) {
+    std::vector<std::byte> encoded = read_bytes(path);
+    std::filesystem::path cache_path =
+        cache_dir / std::format("{:016x}.mip", fnv1a(encoded));
+
+    if (std::filesystem::exists(cache_path)) {
+        try {
+            MappedFile file(cache_path);
+            auto bytes = file.bytes();
+
+            CacheHeader header;
+            if (bytes.size() >= sizeof(header)) {
+                std::memcpy(&header, bytes.data(), sizeof(header));
+            }
+
+            if (bytes.size() >= sizeof(header) &&
+                header.magic == cache_magic &&
+                header.version == cache_version &&
+                bytes.size() ==
+                    sizeof(header) + level_offset(
+                                         header.width, header.height,
+                                         header.levels
+                                     )) {
+                MipChain chain;
+                chain.width = header.width;
+                chain.height = header.height;
+                chain.levels = header.levels;
+                chain.data = bytes.subspan(sizeof(header));
+                chain.mapped = std::move(file);
+
+                return chain;
+            }
+
+            SPDLOG_WARN("Ignoring the corrupt cache {}", cache_path.string());
+        } catch (const std::runtime_error& e) {
+            SPDLOG_WARN(
+                "Ignoring the cache {}: {}", cache_path.string(), e.what()
+            );
+        }
+    }
+
+    auto [image, width, height] =
+        load_image(std::span<const std::byte>(encoded));
+    MipChain chain = build(std::move(image), width, height);
+
+    // A missing cache only costs the next launch some time
+    try {
+        std::filesystem::create_directories(cache_dir);
+        chain.write(cache_path);
+    } catch (const std::exception& e) {
+        SPDLOG_WARN("Could not cache {}: {}", path.string(), e.what());
+    }
+
+    return chain;
+}
+
+MipChain
+MipChain::build(std::vector<std::byte> image, int width, int height) {
+    MipChain chain;
+    chain.width = width;
+    chain.height = height;
+    chain.levels = std::bit_width(unsigned(std::max(width, height)));
+
+    std::array<float, 256> to_linear;
+    for (int i = 0; i < 256; i++) {
+        to_linear[i] = srgb_to_linear(float(i) / 255.0f);
+    }
+
+    image.resize(level_offset(width, height, chain.levels));
+
+    for (int level = 1; level < chain.levels; level++) {
+        const std::byte* src = &image[level_offset(width, height, level - 1)];
+        std::byte* dst = &image[level_offset(width, height, level)];
+
+        int src_width = level_size(width, level - 1);
+        int src_height = level_size(height, level - 1);
+        int dst_width = level_size(width, level);
+        int dst_height = level_size(height, level);
+
+        for (int y = 0; y < dst_height; y++) {
+            for (int x = 0; x < dst_width; x++) {
+                std::array<float, 4> sum{};
+
+                for (int j = 0; j < 2; j++) {
+                    for (int i = 0; i < 2; i++) {
+                        int sx = std::min(2 * x + i, src_width - 1);
+                        int sy = std::min(2 * y + j, src_height - 1);
+                        const std::byte* texel =
+                            &src[(sy * src_width + sx) * 4];
+
+                        for (int c = 0; c < 3; c++) {
+                            sum[c] += to_linear[size_t(texel[c])];
+                        }
+                        sum[3] += float(texel[3]) / 255.0f; // Alpha is linear
+                    }
+                }
+
+                std::byte* texel = &dst[(y * dst_width + x) * 4];
+                for (int c = 0; c < 4; c++) {
+                    float value = sum[c] * 0.25f;
+                    value = c < 3 ? linear_to_srgb(value) : value;
+                    texel[c] = std::byte(
+                        std::clamp(int(value * 255.0f + 0.5f), 0, 255)
+                    );
+                }
+            }
+        }
+    }
+
+    chain.owned = std::move(image);
+    chain.data = chain.owned;
+
+    return chain;
+}
+
+int MipChain::get_width(int level) const noexcept {
+    return level_size(width, level);
+}
+
+int MipChain::get_height(int level) const noexcept {
+    return level_size(height, level);
+}
+
+std::span<const std::byte> MipChain::level(int level) const noexcept {
+    size_t offset = level_offset(width, height, level);
+
+    size_t end = level_offset(width, height, level + 1);
+
+    return data.subspan(offset, end - offset);
+}
+
+void MipChain::write(const std::filesystem::path& path) const {
+    CacheHeader header{
+        cache_magic, cache_version, uint32_t(width), uint32_t(height),
+        uint32_t(levels)
+    };
+
+    // Written next to the target and renamed so that a concurrent or
+    // interrupted launch never maps half a file
+    std::filesystem::path temporary = path;
+    temporary += std::format(".{}.tmp", getpid());
+
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)data.data(), data.size());
+
+        if (!file) {
+            file.close();
+            std::filesystem::remove(temporary);
+            throw std::runtime_error(
+                std::format("Could not write {}", temporary.string())
+            );
+        }
+    }
+
+    std::filesystem::rename(temporary, path);
+}
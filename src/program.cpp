@@ -1,26 +1,326 @@
 #include "program.hpp"
 #include "common.hpp"
 
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <format>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <regex>
+#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 using namespace gl;
 
-Program::Program() noexcept : program(0) {}
+namespace {
+const std::regex include_regex{"#include \"(.+)\""};
+
+const std::filesystem::path program_cache_dir = "cache";
+const std::array<char, 4> program_cache_magic = {'V', 'E', 'P', 'B'};
+
+typedef struct ProgramCacheHeader {
+    std::array<char, 4> magic;
+    uint32_t format; // As reported by glGetProgramBinary
+} ProgramCacheHeader;
+
+std::filesystem::path program_cache_path(uint64_t key) {
+    return program_cache_dir / std::format("{:016x}.program", key);
+}
+
+bool parallel_compile = false;
+
+// Preprocessed sources without defines, keyed by path
+std::mutex prefetch_mutex;
+std::unordered_map<std::string, std::shared_future<std::string>> prefetched;
+
+std::string preprocess(const std::filesystem::path& shader_path) {
+    std::string source = load_file(shader_path);
+    std::stringstream source_stream(source);
+    std::string line;
+    std::ostringstream preprocessed;
+    int i = 2;
+
+    while (std::getline(source_stream, line)) {
+        std::smatch match;
+        if (std::regex_search(line, match, include_regex)) {
+            preprocessed << "#line 1 1" << '\n';
+            preprocessed << load_file(std::filesystem::path(match[1]));
+            preprocessed << "#line " << i << " 0" << '\n';
+        } else if (line ==
+                   "#extension GL_ARB_shading_language_include : require") {
+            preprocessed << "\n\n";
+        } else {
+            preprocessed << line << '\n';
+        }
+
+        i++;
+    }
+
+    return preprocessed.str();
+}
+} // namespace
+
+std::string preprocess_shader(
+    const std::filesystem::path& shader_path, const ShaderDefines& defines
+) {
+    std::shared_future<std::string> future;
+    {
+        std::lock_guard lock(prefetch_mutex);
+        auto prefetch = prefetched.find(shader_path.string());
+        if (prefetch != prefetched.end()) {
+            future = prefetch->second;
+        }
+    }
+
+    std::string source =
+        future.valid() ? future.get() : preprocess(shader_path);
+
+    if (defines.empty()) {
+        return source;
+    }
+
+    // Right after #version, which has to stay the first line
+    std::ostringstream injected;
+    for (auto& [name, value] : defines) {
+        injected << "#define " << name << ' ' << value << '\n';
+    }
+    injected << "#line 2 0" << '\n';
+
+    size_t first_line = source.find('\n');
+    first_line = first_line == std::string::npos ? source.size() : first_line;
+    source.insert(std::min(first_line + 1, source.size()), injected.str());
+
+    return source;
+}
+
+void prefetch_shaders(
+    ThreadPool& pool, const std::vector<std::filesystem::path>& paths
+) {
+    std::lock_guard lock(prefetch_mutex);
+
+    for (auto& path : paths) {
+        if (!prefetched.contains(path.string())) {
+            prefetched.emplace(
+                path.string(),
+                pool.submit([path]() { return preprocess(path); }).share()
+            );
+        }
+    }
+}
+
+bool enable_parallel_shader_compile() {
+    parallel_compile =
+        glfwExtensionSupported("GL_KHR_parallel_shader_compile") != 0;
+
+    if (parallel_compile) {
+        // Let the driver pick the number of threads
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    }
+
+    return parallel_compile;
+}
+
+Program::Program() noexcept : program(0), key(0), pending(false) {}
 Program::~Program() noexcept { glDeleteProgram(program); }
 
-Program::Program(Program&& other) noexcept : program(other.program) {
+Program::Program(Program&& other) noexcept
+    : program(other.program), key(other.key),
+      shaders(std::move(other.shaders)), pending(other.pending) {
     other.program = 0;
+    other.pending = false;
 }
 
 Program& Program::operator=(Program&& other) noexcept {
     using std::swap;
 
     swap(program, other.program);
+    swap(key, other.key);
+    swap(shaders, other.shaders);
+    swap(pending, other.pending);
 
     return *this;
 }
 
-gl::GLuint Program::get() const noexcept { return program; }
+gl::GLuint Program::get() const noexcept {
+    if (pending) {
+        finish();
+    }
+
+    return program;
+}
+
+void Program::use() const noexcept { glUseProgram(get()); }
+
+bool Program::ready() const noexcept {
+    if (!pending || !parallel_compile) {
+        return true;
+    }
+
+    int complete;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+
+    return complete != 0;
+}
+
+void Program::finish() const noexcept {
+    pending = false;
+
+    for (auto& [shader, path] : shaders) {
+        int buflen;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &buflen);
+        std::unique_ptr<char[]> buf = std::make_unique<char[]>(buflen + 1);
+        glGetShaderInfoLog(shader, buflen + 1, &buflen, buf.get());
+
+        SPDLOG_INFO("Filename: {}", path.string());
+        SPDLOG_INFO(buf.get());
+
+        glDetachShader(program, shader);
+    }
+    shaders.clear();
+
+    int buflen;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &buflen);
+    std::unique_ptr<char[]> buf = std::make_unique<char[]>(buflen + 1);
+    glGetProgramInfoLog(program, buflen + 1, &buflen, buf.get());
+
+    SPDLOG_INFO(buf.get());
+
+    store_binary(key);
+}
+
+const Program& ComputeVariants::get(const ShaderDefines& defines) {
+    return find_or_compile(defines).second;
+}
+
+const ComputeVariants::Variant&
+ComputeVariants::get_ready(const ShaderDefines& defines) {
+    const Variant& wanted = find_or_compile(defines);
+
+    if (last == nullptr || wanted.second.ready()) {
+        last = &wanted;
+    }
+
+    return *last;
+}
+
+ComputeVariants::Variant&
+ComputeVariants::find_or_compile(const ShaderDefines& defines) {
+    auto variant = programs.find(defines);
+
+    if (variant == programs.end()) {
+        variant =
+            programs
+                .try_emplace(
+                    defines, Shader<GL_COMPUTE_SHADER>(path, defines)
+                )
+                .first;
+    }
+
+    return *variant;
+}
+
+uint64_t Program::driver_hash() {
+    static const uint64_t hash = []() {
+        uint64_t hash = fnv1a(std::span<const std::byte>{});
+
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const char* value = (const char*)glGetString(name);
+            std::string_view view = value != nullptr ? value : "";
+
+            hash = fnv1a(std::as_bytes(std::span(view)), hash);
+        }
+
+        return hash;
+    }();
+
+    return hash;
+}
 
-void Program::use() const noexcept { glUseProgram(program); }
+bool Program::load_binary(uint64_t key) {
+    std::ifstream file(program_cache_path(key), std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    ProgramCacheHeader header;
+    file.read((char*)&header, sizeof(header));
+
+    std::vector<char> binary;
+    if (file) {
+        binary.assign(std::istreambuf_iterator<char>(file), {});
+    }
+
+    if (binary.empty() || header.magic != program_cache_magic) {
+        SPDLOG_WARN("Ignoring the corrupt program binary {:016x}", key);
+        return false;
+    }
+
+    glProgramBinary(
+        program, GLenum(header.format), binary.data(), binary.size()
+    );
+
+    int status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        // Usually a driver update; Linking from source overwrites it
+        SPDLOG_WARN("The driver rejected the program binary {:016x}", key);
+        return false;
+    }
+
+    SPDLOG_INFO("Loaded the program binary {:016x}", key);
+
+    return true;
+}
+
+void Program::store_binary(uint64_t key) const {
+    int status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (!status || length == 0) {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    ProgramCacheHeader header{program_cache_magic, uint32_t(format)};
+
+    // Same as MipChain::write(); Never let another launch read half a file
+    std::filesystem::path path = program_cache_path(key);
+    std::filesystem::path temporary = path;
+    temporary += std::format(".{}.tmp", getpid());
+
+    try {
+        std::filesystem::create_directories(program_cache_dir);
+
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            file.write((const char*)&header, sizeof(header));
+            file.write(binary.data(), length);
+
+            if (!file) {
+                throw std::runtime_error("Could not write the file");
+            }
+        }
+
+        std::filesystem::rename(temporary, path);
+    } catch (const std::exception& e) {
+        // A missing binary only costs the next launch a compile
+        SPDLOG_WARN("Could not cache the program {:016x}: {}", key, e.what());
+        std::error_code ignored;
+        std::filesystem::remove(temporary, ignored);
+    }
+}
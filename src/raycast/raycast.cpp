@@ -0,0 +1,222 @@
+#include "raycast.hpp"
+#include "aabb.hpp"
+#include "bvh.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <format>
+#include <future>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+// Calls cast(begin, end) over [0, count), in chunks over `pool` when it is
+// worth it. Chunks start at multiples of packet_size.
+template <typename F>
+void for_chunks(size_t count, ThreadPool* pool, const F& cast) {
+    static_assert(raycast_chunk_size % packet_size == 0);
+
+    if (pool == nullptr || pool->size() == 0 || count <= raycast_chunk_size) {
+        cast(size_t(0), count);
+        return;
+    }
+
+    std::vector<std::future<void>> done;
+    for (size_t begin = 0; begin < count; begin += raycast_chunk_size) {
+        size_t end = std::min(begin + raycast_chunk_size, count);
+        done.push_back(pool->submit([&cast, begin, end]() {
+            cast(begin, end);
+        }));
+    }
+
+    for (auto& future : done) {
+        future.get();
+    }
+}
+
+void check_sizes(size_t rays, size_t hits) {
+    if (rays != hits) {
+        SPDLOG_ERROR("{} rays were cast into {} hits", rays, hits);
+        throw std::runtime_error(
+            std::format("{} rays were cast into {} hits", rays, hits)
+        );
+    }
+}
+
+// The rays of [i, end) from i on, padded with the last one
+std::array<Ray, packet_size>
+gather_packet(std::span<const Ray> rays, size_t i, size_t end) {
+    std::array<Ray, packet_size> packet;
+    for (size_t r = 0; r < packet_size; r++) {
+        packet[r] = rays[std::min(i + r, end - 1)];
+    }
+
+    return packet;
+}
+
+RayHit to_hit(const Ray& ray, const FlatTraceResult& result) {
+    if (!result.hit) {
+        return RayHit{false, glm::vec3(0.0f), glm::vec3(0.0f), 0, 0.0f};
+    }
+
+    // Rays across an edge have two limiting axes
+    return RayHit{
+        true, result.pos, glm::normalize(result.normal), result.mat_id,
+        glm::length(result.pos - ray.origin)
+    };
+}
+} // namespace
+
+void raycast_batch(
+    std::span<const SerializedNode> nodes, uint32_t level,
+    std::span<const Ray> rays, std::span<RayHit> hits, ThreadPool* pool
+) {
+    check_sizes(rays.size(), hits.size());
+
+    for_chunks(rays.size(), pool, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i += packet_size) {
+            auto results =
+                trace_flat_packet(nodes, level, gather_packet(rays, i, end));
+
+            for (size_t r = 0; r < packet_size && i + r < end; r++) {
+                hits[i + r] = to_hit(rays[i + r], results[r]);
+            }
+        }
+    });
+}
+
+void raycast_batch(
+    const SvoDag& svodag, std::span<const Ray> rays, std::span<RayHit> hits,
+    ThreadPool* pool
+) {
+    std::vector<SerializedNode> nodes = svodag.serialize();
+
+    raycast_batch(nodes, svodag.get_level(), rays, hits, pool);
+}
+
+void raycast_scene(
+    std::span<const RaycastInstance> instances, std::span<const Ray> rays,
+    std::span<SceneHit> hits, ThreadPool* pool
+) {
+    check_sizes(rays.size(), hits.size());
+
+    std::vector<Aabb> bounds;
+    std::vector<glm::mat4> inv_transforms;
+    std::vector<glm::mat3> normal_transforms;
+    for (auto& instance : instances) {
+        // Every model spans (0, 0, 0) ~ (1, 1, 1) in model space
+        bounds.push_back(transform_aabb(
+            Aabb{glm::vec3(0.0f), glm::vec3(1.0f)}, instance.transform
+        ));
+        inv_transforms.push_back(glm::inverse(instance.transform));
+        normal_transforms.push_back(
+            glm::mat3(glm::transpose(inv_transforms.back()))
+        );
+    }
+
+    InstanceBvh bvh;
+    bvh.build(bounds);
+    const auto& bvh_nodes = bvh.get_nodes();
+    const auto& bvh_indices = bvh.get_indices();
+
+    const float inf = std::numeric_limits<float>::infinity();
+
+    for_chunks(rays.size(), pool, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i += packet_size) {
+            std::array<Ray, packet_size> packet = gather_packet(rays, i, end);
+
+            std::array<glm::vec3, packet_size> dir_invs;
+            std::array<SceneHit, packet_size> nearest;
+            for (size_t r = 0; r < packet_size; r++) {
+                dir_invs[r] = 1.0f / packet[r].dir;
+                nearest[r] = SceneHit{
+                    false, glm::vec3(0.0f), glm::vec3(0.0f), 0, inf, entt::null
+                };
+            }
+
+            // max_depth of the builder keeps it far below this
+            std::array<uint32_t, 64> stack;
+            size_t stack_size = 0;
+            if (!bvh_nodes.empty()) {
+                stack[stack_size++] = 0;
+            }
+
+            while (stack_size > 0) {
+                const BvhNode& node = bvh_nodes[stack[--stack_size]];
+
+                // Skipped unless some ray of the packet passes the node
+                // closer than its nearest hit so far
+                bool entered = false;
+                for (size_t r = 0; r < packet_size && !entered; r++) {
+                    auto [tmin, tmax] = slab_test(
+                        node.aabb_min, node.aabb_max, packet[r].origin,
+                        dir_invs[r]
+                    );
+                    entered = tmax >= std::max(tmin, 0.0f) &&
+                              tmin <= nearest[r].distance;
+                }
+
+                if (!entered) {
+                    continue;
+                }
+
+                if (node.count == 0) {
+                    stack[stack_size++] = node.left_first;
+                    stack[stack_size++] = node.left_first + 1;
+                    continue;
+                }
+
+                for (uint32_t k = 0; k < node.count; k++) {
+                    uint32_t index = bvh_indices[node.left_first + k];
+                    const RaycastInstance& instance = instances[index];
+                    const glm::mat4& inv_transform = inv_transforms[index];
+
+                    std::array<Ray, packet_size> model_rays;
+                    for (size_t r = 0; r < packet_size; r++) {
+                        model_rays[r] = Ray{
+                            inv_transform * glm::vec4(packet[r].origin, 1.0f),
+                            glm::normalize(glm::vec3(
+                                inv_transform * glm::vec4(packet[r].dir, 0.0f)
+                            ))
+                        };
+                    }
+
+                    auto results = trace_flat_packet(
+                        instance.nodes, instance.level, model_rays
+                    );
+
+                    for (size_t r = 0; r < packet_size; r++) {
+                        if (!results[r].hit) {
+                            continue;
+                        }
+
+                        glm::vec3 pos = instance.transform *
+                                        glm::vec4(results[r].pos, 1.0f);
+                        float distance = glm::length(pos - packet[r].origin);
+
+                        if (distance < nearest[r].distance) {
+                            nearest[r] = SceneHit{
+                                true, pos,
+                                glm::normalize(
+                                    normal_transforms[index] *
+                                    results[r].normal
+                                ),
+                                results[r].mat_id, distance, instance.entity
+                            };
+                        }
+                    }
+                }
+            }
+
+            for (size_t r = 0; r < packet_size && i + r < end; r++) {
+                hits[i + r] = nearest[r];
+                if (!nearest[r].hit) {
+                    hits[i + r].distance = 0.0f;
+                }
+            }
+        }
+    });
+}
@@ -24,9 +24,16 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <format>
+#include <fstream>
+#include <future>
+#include <limits>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 using namespace gl;
 
@@ -105,11 +112,56 @@ void message_callback(
     }
 }
 
-Renderer::Renderer(int width, int height)
-    : width(width), height(height), window(width, height, "asdf"), vbo(), vao(),
-      ibo(), camera(), cubemap(), quad_texture() {
+// The largest shared memory footprint of the compute shaders, the node cache
+// of common.comp or the sample apron of 3_spatial_reuse.comp, which compiles
+// the cache out. GL only guarantees 32 KiB.
+void check_shared_memory() {
+    size_t node_cache_bytes =
+        max_cached_models * node_cache_size * sizeof(SerializedNode);
+    size_t apron_bytes =
+        spatial_apron_width * spatial_apron_width * sizeof(PackedSample);
+    size_t needed = std::max(node_cache_bytes, apron_bytes);
+
+    GLint available = 0;
+    glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &available);
+
+    if (size_t(available) < needed) {
+        SPDLOG_CRITICAL(
+            "Compute shaders need {} bytes of shared memory, {} available",
+            needed, available
+        );
+        throw std::runtime_error(std::format(
+            "Compute shaders need {} bytes of shared memory, {} available",
+            needed, available
+        ));
+    }
+}
+
+Renderer::Renderer(int width, int height, bool visible, bool present)
+    : width(width), height(height), present(present),
+      window(width, height, "asdf", visible),
+      vbo(), vao(),
+      ibo(), camera(), cubemap(), quad_texture(), ray_start_texture(),
+      ray_start_fbo(), gbuffer_texture(), gbuffer_depth_texture(),
+      gbuffer_fbo(), motion_texture() {
     ensure_glbinding();
 
+#ifndef NDEBUG
+    // Debug builds report GL errors as they happen, such as a uniform set
+    // with the wrong type, instead of leaving it silently unset
+    glEnable(GL_DEBUG_OUTPUT);
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    glDebugMessageCallback(message_callback, nullptr);
+    glDebugMessageControl(
+        GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr,
+        GL_FALSE
+    );
+#endif
+
+    check_shared_memory();
+
+    build_programs();
+
     int fb_width, fb_height;
     glfwGetFramebufferSize(window.get(), &fb_width, &fb_height);
     gl::glViewport(0, 0, fb_width, fb_height);
@@ -129,17 +181,67 @@ Renderer::Renderer(int width, int height)
 
     SPDLOG_INFO("Creating SSBO");
     svodag_ssbo = AppendBuffer<SerializedNode, GL_SHADER_STORAGE_BUFFER>{30000};
-    metadata_ssbo = VectorBuffer<SvodagMetaData, GL_SHADER_STORAGE_BUFFER>{100};
+    metadata_ssbo =
+        VectorBuffer<SvodagMetaData, GL_SHADER_STORAGE_BUFFER>{max_instances};
+    bvh_ssbo =
+        VectorBuffer<BvhNode, GL_SHADER_STORAGE_BUFFER>{2 * max_instances};
+    bvh_index_ssbo =
+        VectorBuffer<uint32_t, GL_SHADER_STORAGE_BUFFER>{max_instances};
     materials = AppendBuffer<Material, GL_SHADER_STORAGE_BUFFER>{1024};
+    occupancy_ssbo =
+        AppendBuffer<OccupancyNode, GL_SHADER_STORAGE_BUFFER>{30000};
+    mesh_quads =
+        AppendBuffer<MeshQuad, GL_SHADER_STORAGE_BUFFER>{max_mesh_quads};
     materials.push_back(Material{});
     svodag_ssbo.push_back(SerializedNode{});
 
-    reservoirs =
-        ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{width * height * 200};
-    prev_reservoirs =
-        ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{width * height * 200};
+    uint32_t tiles_x = (width + bin_tile_size - 1) / bin_tile_size;
+    uint32_t tiles_y = (height + bin_tile_size - 1) / bin_tile_size;
+
+    instance_rects = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+        (GLsizeiptr)(max_instances * sizeof(glm::vec4))
+    };
+    tile_counts = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+        tiles_x * tiles_y * sizeof(uint32_t)
+    };
+    tile_instances = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+        tiles_x * tiles_y * max_tile_instances * sizeof(uint32_t)
+    };
+    bin_stats =
+        ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{sizeof(TileBinStats)};
+
+    wavefront_queue = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+        (GLsizeiptr)((4 + width * height) * sizeof(uint32_t))
+    };
+
+    reservoirs = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+        (GLsizeiptr)(width * height * sizeof(PackedSample))
+    };
+    prev_reservoirs = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+        (GLsizeiptr)(width * height * sizeof(PackedSample))
+    };
+    spatial_reservoirs = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+        (GLsizeiptr)(width * height * sizeof(PackedSample))
+    };
+    hit_instances = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+        (GLsizeiptr)(width * height * sizeof(uint32_t))
+    };
+    node_fetch_stats = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+        (GLsizeiptr)(pass_count * sizeof(glm::uvec2))
+    };
+    gpu_timers = GpuTimers(std::vector<std::string>(
+        pass_names.begin(), pass_names.begin() + pass_other
+    ));
 
     quad_texture = Texture2D(1, GL_RGBA32F, GL_RGBA, width, height, false);
+    ray_start_texture = Texture2D(1, GL_R32F, GL_RED, width, height, false);
+    ray_start_fbo = Framebuffer(ray_start_texture);
+    gbuffer_texture = Texture2D(1, GL_RGBA32F, GL_RGBA, width, height, false);
+    gbuffer_depth_texture = Texture2D(
+        1, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, width, height, false
+    );
+    gbuffer_fbo = Framebuffer(gbuffer_texture, gbuffer_depth_texture);
+    motion_texture = Texture2D(1, GL_RG32F, GL_RG, width, height, false);
 
     ensure_imgui(window.get());
 }
@@ -151,6 +253,7 @@ bool Renderer::main_loop(
     // glClear(GL_COLOR_BUFFER_BIT);
 
     glfwPollEvents();
+    gpu_timers.begin_frame();
 
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -160,20 +263,59 @@ bool Renderer::main_loop(
     f(window, camera);
 
     metadata_ssbo.data.clear();
+    instance_bounds.clear();
+    bool every_instance_meshed = true;
+    std::unordered_map<entt::entity, glm::mat4> transforms;
     registry.view<Renderable, Transformable>().each(
         [&](auto entity, Renderable& renderable, Transformable& transformable) {
             if (renderable.visible) {
+                glm::mat4 transform = transformable.get_transform();
+                transforms.emplace(entity, transform);
+
+                // Entities that just appeared did not move
+                auto prev = prev_transforms.find(entity);
+                glm::mat4 prev_transform =
+                    prev != prev_transforms.end() ? prev->second : transform;
+
+                auto occupancy = occupancy_offsets.find(renderable.model_id);
+                unsigned int occupancy_at_index =
+                    occupancy != occupancy_offsets.end() ? occupancy->second
+                                                         : no_occupancy;
+
+                every_instance_meshed =
+                    every_instance_meshed &&
+                    mesh_ranges.contains(renderable.model_id);
+
                 metadata_ssbo.data.emplace_back(
-                    transformable.get_inv_transform(),
-                    transformable.get_transform(),
-                    transformable.get_normal_transform(), renderable.max_level,
-                    renderable.model_id
+                    transformable.get_inv_transform(), transform,
+                    transformable.get_normal_transform(), prev_transform,
+                    renderable.max_level, renderable.model_id,
+                    occupancy_at_index
                 );
+
+                // Every model spans (0, 0, 0) ~ (1, 1, 1) in model space
+                instance_bounds.push_back(transform_aabb(
+                    Aabb{glm::vec3(0.0f), glm::vec3(1.0f)},
+                    transformable.get_transform()
+                ));
             }
         }
     );
 
     metadata_ssbo.upload();
+    select_cached_models();
+
+    // The ring buffers have to be written every frame regardless of whether
+    // the tree changed, since each frame writes a different slot.
+    instance_bvh.update(instance_bounds);
+    bvh_ssbo.data.assign(
+        instance_bvh.get_nodes().begin(), instance_bvh.get_nodes().end()
+    );
+    bvh_index_ssbo.data.assign(
+        instance_bvh.get_indices().begin(), instance_bvh.get_indices().end()
+    );
+    bvh_ssbo.upload();
+    bvh_index_ssbo.upload();
 
     ImGui::SliderFloat("Bias Amount", &bias_amt, 0.0f, .01f, "%.5f");
     ImGui::SliderFloat(
@@ -185,8 +327,60 @@ bool Renderer::main_loop(
     ImGui::SliderInt("Initial samples", &initial_sample_count, 1, 64);
     ImGui::Checkbox("Temporal reuse?", &temporal_reuse);
     ImGui::Checkbox("Spatial reuse?", &spatial_reuse);
+    ImGui::SliderInt("Spatial neighbors", &spatial_neighbor_count, 1, 16);
+    ImGui::SliderInt("Spatial iterations", &spatial_iterations, 1, 4);
     ImGui::Checkbox("Spatial first?", &spatial_first);
     ImGui::Checkbox("Visibility reuse", &visibility_reuse);
+    ImGui::Checkbox("Use instance BVH?", &use_instance_bvh);
+    ImGui::Checkbox("Use tile instance bins?", &use_tile_bins);
+    ImGui::Checkbox("Rasterize ray start distances?", &use_ray_start);
+    ImGui::Checkbox("Cache top DAG nodes?", &use_node_cache);
+    ImGui::Checkbox("Use occupancy DAG for shadows?", &use_occupancy);
+    ImGui::Checkbox("Importance sample the skybox?", &use_environment_sampling);
+    ImGui::Checkbox("Show node fetch stats?", &show_node_fetch_stats);
+    if (show_node_fetch_stats) {
+        for (int i = 0; i < pass_count; i++) {
+            auto [cached, global] = last_node_fetch_stats[i];
+            if (cached + global == 0) {
+                continue;
+            }
+
+            ImGui::Text(
+                "%s: %u cached, %u global (%.1f%% saved)", pass_names[i],
+                cached, global, 100.0f * cached / (cached + global)
+            );
+        }
+    }
+    ImGui::Checkbox("Show tile bin stats?", &show_bin_stats);
+    if (show_bin_stats && last_bin_stats.tiles > 0) {
+        ImGui::Text(
+            "Instances per tile: avg %.2f, max %u, %u/%u tiles overflowed",
+            (float)last_bin_stats.total_entries / last_bin_stats.tiles,
+            last_bin_stats.max_entries, last_bin_stats.overflowed_tiles,
+            last_bin_stats.tiles
+        );
+    }
+    ImGui::Checkbox("Show GPU timings?", &show_gpu_timings);
+    if (show_gpu_timings) {
+        for (size_t i = 0; i <= gpu_timers.pass_count(); i++) {
+            GpuTimers::Stats stats = gpu_timers.stats(i);
+            if (stats.samples == 0) {
+                continue;
+            }
+
+            ImGui::Text(
+                "%s: avg %.3f ms, p50 %.3f, p95 %.3f, p99 %.3f",
+                gpu_timers.name(i).c_str(), stats.average, stats.p50,
+                stats.p95, stats.p99
+            );
+        }
+
+        if (ImGui::Button("Dump GPU timings")) {
+            gpu_timers.write_csv("gpu_timings.csv");
+            gpu_timers.write_json("gpu_timings.json");
+        }
+    }
+    ImGui::Checkbox("Specialize shaders?", &specialize_shaders);
     ImGui::Checkbox("Debug: Show normal?", &debug_normal_view);
     ImGui::Checkbox("Debug: Show hit position?", &debug_pos_view);
     ImGui::Checkbox("Debug: Show UCW?", &debug_weight_view);
@@ -194,78 +388,214 @@ bool Renderer::main_loop(
     ImGui::Checkbox(
         "Debug: Visualize shadow trace result?", &debug_visualize_shadow
     );
+    ImGui::Checkbox(
+        "Debug: Collect traversal stats?", &collect_traversal_stats
+    );
+    if (collect_traversal_stats) {
+        const TraversalTotals& totals = last_traversal_totals;
+        float rays = std::max(totals.rays, 1u);
+
+        ImGui::Text(
+            "%u rays, %.1f steps and %.1f node fetches per ray, %.2f%% capped",
+            totals.rays, totals.steps / rays, totals.fetches / rays,
+            100.0f * totals.capped / rays
+        );
+
+        std::array<float, traversal_levels> level_steps;
+        std::copy(
+            totals.level_steps.begin(), totals.level_steps.end(),
+            level_steps.begin()
+        );
+        ImGui::PlotHistogram(
+            "Steps by level", level_steps.data(), level_steps.size()
+        );
+
+        ImGui::Combo(
+            "Heatmap", &traversal_heatmap_metric,
+            "Off\0Steps\0Node fetches\0Capped rays\0"
+        );
+        ImGui::SliderFloat(
+            "Heatmap maximum", &traversal_heatmap_max, 1.0f, 1000.0f, "%.0f",
+            ImGuiSliderFlags_Logarithmic
+        );
+
+        if (ImGui::Button("Dump traversal stats")) {
+            write_traversal_stats(
+                "traversal_pixels.csv", "traversal_levels.csv"
+            );
+        }
+    }
     ImGui::Checkbox("Use megakernel?", &megakernel);
+    if (!megakernel) {
+        ImGui::Checkbox("Wavefront: compact hit pixels?", &wavefront);
+        ImGui::Checkbox(
+            "Rasterize greedy meshes for first hits?", &use_raster_gbuffer
+        );
+    }
     ImGui::End();
 
-    if (megakernel) {
-        restir_before_reuse.use();
-        bind_everything();
-        glDispatchCompute(width / 8, height / 8, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if (use_raster_gbuffer) {
+        collect_meshes();
+    }
 
-        restir_after_reuse.use();
-        bind_everything();
-        glDispatchCompute(width / 8, height / 8, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    raster_gbuffer_active =
+        use_raster_gbuffer && !megakernel && every_instance_meshed;
+
+    if (use_tile_bins) {
+        bin_instances();
+    }
+
+    // raster_primary() does not read the ray start distances
+    if (use_ray_start && !raster_gbuffer_active) {
+        rasterize_ray_start();
+    }
+
+    if (raster_gbuffer_active) {
+        rasterize_gbuffer();
+    }
+
+    if (show_node_fetch_stats) {
+        glClearNamedBufferData(
+            node_fetch_stats.get(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
+            nullptr
+        );
+    }
+
+    if (collect_traversal_stats) {
+        // Only allocated once asked for, it takes 16 bytes per pixel
+        if (!traversal_stats.owns()) {
+            traversal_stats = ImmutableBuffer<GL_SHADER_STORAGE_BUFFER>{
+                (GLsizeiptr)(sizeof(TraversalTotals) +
+                             width * height * sizeof(glm::uvec4))
+            };
+        }
+
+        glClearNamedBufferData(
+            traversal_stats.get(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
+            nullptr
+        );
+    }
+
+    if (megakernel) {
+        dispatch(
+            restir_before_reuse, pass_before_reuse,
+            GL_SHADER_STORAGE_BARRIER_BIT
+        );
+        dispatch(velocity, pass_velocity, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        dispatch(
+            restir_after_reuse, pass_after_reuse, GL_SHADER_STORAGE_BARRIER_BIT
+        );
     } else {
-        micro_restir_first_hit.use();
-        bind_everything();
-        glDispatchCompute(width / 8, height / 8, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        WavefrontMode compacted =
+            wavefront ? wavefront_compacted : wavefront_off;
 
-        micro_restir_sample_generation.use();
-        bind_everything();
-        glDispatchCompute(width / 8, height / 8, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        if (wavefront) {
+            glClearNamedBufferSubData(
+                wavefront_queue.get(), GL_R32UI, 0, 4 * sizeof(uint32_t),
+                GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr
+            );
+        }
+
+        dispatch(
+            micro_restir_first_hit, pass_first_hit,
+            GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT,
+            wavefront ? wavefront_fill : wavefront_off
+        );
+
+        dispatch(
+            velocity, pass_velocity, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT,
+            compacted
+        );
+
+        dispatch(
+            micro_restir_sample_generation, pass_sample_generation,
+            GL_SHADER_STORAGE_BARRIER_BIT, compacted
+        );
 
         if (spatial_first) {
             if (spatial_reuse) {
-                micro_restir_spatial_reuse.use();
-                bind_everything();
-                glDispatchCompute(width / 8, height / 8, 1);
-                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                spatial_reuse_passes();
             }
 
             if (temporal_reuse) {
-                micro_restir_temporal_reuse.use();
-                bind_everything();
-                glDispatchCompute(width / 8, height / 8, 1);
-                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                dispatch(
+                    micro_restir_temporal_reuse, pass_temporal_reuse,
+                    GL_SHADER_STORAGE_BARRIER_BIT, compacted
+                );
             }
         } else {
             if (temporal_reuse) {
-                micro_restir_temporal_reuse.use();
-                bind_everything();
-                glDispatchCompute(width / 8, height / 8, 1);
-                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                dispatch(
+                    micro_restir_temporal_reuse, pass_temporal_reuse,
+                    GL_SHADER_STORAGE_BARRIER_BIT, compacted
+                );
             }
 
             if (spatial_reuse) {
-                micro_restir_spatial_reuse.use();
-                bind_everything();
-                glDispatchCompute(width / 8, height / 8, 1);
-                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                spatial_reuse_passes();
             }
         }
 
-        micro_restir_shade.use();
-        bind_everything();
-        glDispatchCompute(width / 8, height / 8, 1);
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        // Sky pixels still have to be shaded
+        dispatch(
+            micro_restir_shade, pass_shade, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+        );
     }
 
-    quad_renderer.use();
-    vao.bind();
-    quad_texture.bind(0);
+    if (collect_traversal_stats) {
+        if (traversal_heatmap_metric > 0) {
+            traversal_heatmap.use();
+            bind_everything();
+            glUniform1i(49, traversal_heatmap_metric - 1);
+            glUniform1f(50, traversal_heatmap_max);
+            glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        }
+
+        // Stalls until the frame finishes; Only meant for tuning
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glGetNamedBufferSubData(
+            traversal_stats.get(), 0, sizeof(last_traversal_totals),
+            &last_traversal_totals
+        );
+    }
 
-    glDrawElements(gl::GLenum::GL_TRIANGLES, 3, GL_UNSIGNED_INT, 0);
+    if (show_node_fetch_stats) {
+        // Stalls until the frame finishes; Only meant for tuning
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glGetNamedBufferSubData(
+            node_fetch_stats.get(), 0, sizeof(last_node_fetch_stats),
+            last_node_fetch_stats.data()
+        );
+    }
 
-    ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    if (present) {
+        quad_renderer.use();
+        vao.bind();
+        quad_texture.bind(0);
 
-    glfwSwapBuffers(window.get());
+        glDrawElements(gl::GLenum::GL_TRIANGLES, 3, GL_UNSIGNED_INT, 0);
+
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+
+        glfwSwapBuffers(window.get());
+    } else {
+        ImGui::EndFrame();
+    }
 
     metadata_ssbo.lock();
+    bvh_ssbo.lock();
+    bvh_index_ssbo.lock();
+
+    // This frame's samples become the history of the next one
+    std::swap(prev_reservoirs, megakernel ? spatial_reservoirs : reservoirs);
+    prev_transforms = std::move(transforms);
+
+    prev_camera_pos = camera.get_pos();
+    prev_camera_dir = camera.get_dir();
+    prev_camera_x_basis = camera.camera_x_basis();
+    prev_camera_y_basis = camera.camera_y_basis();
 
     is_first_frame = false;
     return glfwWindowShouldClose(window.get());
@@ -273,47 +603,177 @@ bool Renderer::main_loop(
 
 GLFWwindow* Renderer::get_window() const { return window.get(); }
 
+std::vector<std::byte> Renderer::read_image() const {
+    std::vector<glm::vec4> texels(width * height);
+    glGetTextureImage(
+        quad_texture.get(), 0, GL_RGBA, GL_FLOAT,
+        texels.size() * sizeof(glm::vec4), texels.data()
+    );
+
+    // The texture is linear and its first row is the bottom one
+    std::vector<std::byte> image(width * height * 4);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            glm::vec4 texel = texels[(height - 1 - y) * width + x];
+            std::byte* pixel = &image[(y * width + x) * 4];
+
+            for (int c = 0; c < 4; c++) {
+                float value = std::clamp(texel[c], 0.0f, 1.0f);
+                value = c < 3 ? linear_to_srgb(value) : 1.0f;
+                pixel[c] = std::byte(int(value * 255.0f + 0.5f));
+            }
+        }
+    }
+
+    return image;
+}
+
+void Renderer::raycast_batch(
+    const entt::registry& registry, std::span<const Ray> rays,
+    std::span<SceneHit> hits
+) {
+    std::span<const SerializedNode> nodes = svodag_ssbo.cpu_data();
+
+    std::vector<RaycastInstance> instances;
+    registry.view<const Renderable, const Transformable>().each(
+        [&](auto entity, const Renderable& renderable,
+            const Transformable& transformable) {
+            if (renderable.visible) {
+                instances.push_back(RaycastInstance{
+                    nodes.subspan(
+                        renderable.model_id,
+                        model_sizes.at(renderable.model_id)
+                    ),
+                    renderable.max_level, transformable.get_transform(), entity
+                });
+            }
+        }
+    );
+
+    raycast_scene(instances, rays, hits, &workers);
+}
+
 void Renderer::use_cubemap(const std::array<std::filesystem::path, 6>& path) {
-    std::array<std::vector<std::byte>, 6> images;
-    std::array<std::span<std::byte>, 6> spans;
-    int result_width;
+    std::array<std::future<MipChain>, 6> futures;
+    for (int i = 0; i < 6; i++) {
+        futures[i] = workers.submit([&path, i]() {
+            return MipChain::load(path[i]);
+        });
+    }
 
+    std::array<MipChain, 6> faces;
+    std::array<std::span<const std::byte>, 6> spans;
     for (int i = 0; i < 6; i++) {
-        auto [image, img_width, img_height] = load_image(path[i]);
+        faces[i] = futures[i].get();
+        spans[i] = faces[i].level(0);
+    }
+
+    int result_width = faces[0].get_width();
 
-        images[i] = std::move(image);
-        spans[i] = images[i];
+    cubemap = CubeMap(faces, gl::GLenum::GL_SRGB8_ALPHA8);
 
-        result_width = img_width;
+    std::vector<AliasEntry> table =
+        build_alias_table(environment_weights(spans, result_width));
+
+    environment_table = Buffer<GL_SHADER_STORAGE_BUFFER>{
+        table.size() * sizeof(AliasEntry), (BufferStorageMask)0, table.data()
+    };
+    environment_table_resolution =
+        uint32_t(std::min(result_width, environment_resolution));
+}
+
+// Issues every compile and link up front without waiting for any of them, so
+// that the driver works on them while the caller builds models and loads the
+// skybox. Program checks the results on first use.
+void Renderer::build_programs() {
+    if (enable_parallel_shader_compile()) {
+        SPDLOG_INFO("Compiling shaders in parallel");
     }
 
-    cubemap = CubeMap(
-        spans, gl::GLenum::GL_SRGB8_ALPHA8, gl::GLenum::GL_RGBA, result_width
+    prefetch_shaders(
+        workers,
+        {"simple.vert", "draw_texture.frag", "0_first_hit.comp",
+         "1_sample_generation.comp", "2_temporal_reuse.comp",
+         "3_spatial_reuse.comp", "4_shade.comp", "before_reuse.comp",
+         "after_reuse.comp", "box_depth.vert", "box_depth.frag",
+         "mesh_gbuffer.vert", "mesh_gbuffer.frag", "velocity.comp",
+         "instance_projection.comp", "tile_binning.comp",
+         "traversal_heatmap.comp"}
     );
+
+    quad_renderer = Program{
+        Shader<GL_VERTEX_SHADER>(std::filesystem::path("simple.vert")),
+        Shader<GL_FRAGMENT_SHADER>(std::filesystem::path("draw_texture.frag"))
+    };
+
+    box_depth = Program{
+        Shader<GL_VERTEX_SHADER>(std::filesystem::path("box_depth.vert")),
+        Shader<GL_FRAGMENT_SHADER>(std::filesystem::path("box_depth.frag"))
+    };
+
+    mesh_gbuffer = Program{
+        Shader<GL_VERTEX_SHADER>(std::filesystem::path("mesh_gbuffer.vert")),
+        Shader<GL_FRAGMENT_SHADER>(std::filesystem::path("mesh_gbuffer.frag"))
+    };
+
+    velocity = Program{
+        Shader<GL_COMPUTE_SHADER>(std::filesystem::path("velocity.comp"))
+    };
+
+    instance_projection = Program{Shader<GL_COMPUTE_SHADER>(
+        std::filesystem::path("instance_projection.comp")
+    )};
+
+    tile_binning = Program{
+        Shader<GL_COMPUTE_SHADER>(std::filesystem::path("tile_binning.comp"))
+    };
+
+    traversal_heatmap = Program{Shader<GL_COMPUTE_SHADER>(
+        std::filesystem::path("traversal_heatmap.comp")
+    )};
+
+    for (ComputeVariants* variants :
+         {&micro_restir_first_hit, &micro_restir_sample_generation,
+          &micro_restir_temporal_reuse, &micro_restir_spatial_reuse,
+          &micro_restir_shade, &restir_before_reuse, &restir_after_reuse}) {
+        variant(*variants);
+    }
 }
 
-void Renderer::bind_everything() {
+// Programs built with shader_defines() have the toggles baked in, and have no
+// uniforms at their locations
+void Renderer::bind_everything(bool specialized) {
     svodag_ssbo.bind(3);
     metadata_ssbo.bind(2);
+    bvh_ssbo.bind(7);
+    bvh_index_ssbo.bind(8);
     materials.bind(6);
+    occupancy_ssbo.bind(10);
     cubemap.bind(0);
+    environment_table.bind(11);
     reservoirs.bind(18);
     prev_reservoirs.bind(21);
+    spatial_reservoirs.bind(19);
+    hit_instances.bind(20);
+    node_fetch_stats.bind(17);
+    traversal_stats.bind(22);
+    wavefront_queue.bind(16);
+    instance_rects.bind(12);
+    tile_counts.bind(13);
+    tile_instances.bind(14);
+    bin_stats.bind(15);
     glUniform1i(12, 0);
     glUniform1i(15, width);
     glUniform1i(16, height);
     glUniform1i(17, is_first_frame);
-    glUniform1i(20, temporal_reuse);
-    glUniform1i(22, debug_normal_view);
-    glUniform1i(23, debug_pos_view);
-    glUniform1i(24, debug_weight_view);
-    glUniform1i(25, debug_ignore_shadow);
     glUniform1i(26, initial_sample_count);
     glUniform1f(27, surface_bias_amt);
-    glUniform1i(28, visibility_reuse);
-    glUniform1i(29, debug_visualize_shadow);
+    glUniform1i(30, use_instance_bvh);
+    glUniform1i(31, use_tile_bins);
+    glUniform1i(32, use_ray_start);
+    glUniform1i(33, wavefront_off);
 
-    glUniform1f(13, (float)glfwGetTime());
+    glUniform1f(13, fixed_seed.value_or((float)glfwGetTime()));
 
     glm::vec3 x_basis = camera.camera_x_basis();
     glm::vec3 y_basis = camera.camera_y_basis();
@@ -326,6 +786,36 @@ void Renderer::bind_everything() {
     glUniform3fv(5, 1, glm::value_ptr(x_basis));
     glUniform3fv(4, 1, glm::value_ptr(y_basis));
 
+    glUniform3fv(34, 1, glm::value_ptr(prev_camera_pos));
+    glUniform3fv(35, 1, glm::value_ptr(prev_camera_dir));
+    glUniform3fv(36, 1, glm::value_ptr(prev_camera_x_basis));
+    glUniform3fv(37, 1, glm::value_ptr(prev_camera_y_basis));
+
+    glUniform1i(38, spatial_neighbor_count);
+    glUniform1i(39, 0);
+    glUniform1i(40, use_node_cache);
+    glUniform1i(41, cached_model_count);
+    glUniform4uiv(42, 1, glm::value_ptr(cached_models));
+    glUniform4uiv(43, 1, glm::value_ptr(cached_model_sizes));
+    glUniform1i(45, pass_other);
+    glUniform1i(46, use_occupancy);
+    glUniform1i(
+        47, use_environment_sampling && environment_table_resolution > 0
+    );
+    glUniform1ui(48, environment_table_resolution);
+    glUniform1i(51, raster_gbuffer_active);
+
+    if (!specialized) {
+        glUniform1i(20, temporal_reuse);
+        glUniform1i(22, debug_normal_view);
+        glUniform1i(23, debug_pos_view);
+        glUniform1i(24, debug_weight_view);
+        glUniform1i(25, debug_ignore_shadow);
+        glUniform1i(28, visibility_reuse);
+        glUniform1i(29, debug_visualize_shadow);
+        glUniform1i(44, show_node_fetch_stats);
+    }
+
     glUniform1ui(8, metadata_ssbo.data.size());
 
     glUniform1f(6, bias_amt);
@@ -335,4 +825,335 @@ void Renderer::bind_everything() {
     glUniform1f(11, roughness);
 
     quad_texture.bind_image(1, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    ray_start_texture.bind_image(2, 0, GL_READ_ONLY, GL_R32F);
+    gbuffer_texture.bind_image(4, 0, GL_READ_ONLY, GL_RGBA32F);
+    motion_texture.bind_image(3, 0, GL_READ_WRITE, GL_RG32F);
+}
+
+// Toggles that the ReSTIR passes get as constants instead of uniforms, see
+// common.comp
+ShaderDefines Renderer::shader_defines() const {
+    auto value = [](bool toggle) { return toggle ? "true" : "false"; };
+
+    return {
+        {"SPECIALIZED", ""},
+        {"T_REUSE", value(temporal_reuse)},
+        {"D_NORMAL", value(debug_normal_view)},
+        {"D_POS", value(debug_pos_view)},
+        {"D_WEIGHT", value(debug_weight_view)},
+        {"D_SHADOW", value(debug_ignore_shadow)},
+        {"V_REUSE", value(visibility_reuse)},
+        {"D_SHOW_SHADOW", value(debug_visualize_shadow)},
+        {"COUNT_NODE_FETCHES", value(show_node_fetch_stats)},
+    };
+}
+
+// Variants are compiled on first use. After flipping a toggle the previous
+// variant keeps rendering until the driver has finished the new one, unless
+// the program binary cache already has it.
+const ComputeVariants::Variant& Renderer::variant(ComputeVariants& variants) {
+    ShaderDefines defines =
+        specialize_shaders ? shader_defines() : ShaderDefines{};
+
+    if (collect_traversal_stats) {
+        defines.emplace_back("TRAVERSAL_STATS", "");
+    }
+
+    return variants.get_ready(defines);
+}
+
+// Whether the toggles of the variant are constants, see shader_defines()
+bool is_specialized(const ComputeVariants::Variant& variant) {
+    return std::ranges::any_of(variant.first, [](auto& define) {
+        return define.first == "SPECIALIZED";
+    });
+}
+
+// Compacted passes run one invocation per queued pixel through the indirect
+// arguments written by 0_first_hit.comp. Everything else covers the whole
+// image, rounding up so that edge pixels are not dropped.
+void Renderer::dispatch(
+    const Program& program, RenderPass pass, MemoryBarrierMask barriers,
+    WavefrontMode mode, bool specialized
+) {
+    program.use();
+    bind_everything(specialized);
+    glUniform1i(33, mode);
+    glUniform1i(45, pass);
+
+    if (pass < pass_other) {
+        gpu_timers.begin(pass);
+    }
+
+    if (mode == wavefront_compacted) {
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, wavefront_queue.get());
+        glDispatchComputeIndirect(0);
+    } else {
+        glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+    }
+
+    glMemoryBarrier(barriers);
+    gpu_timers.end();
+}
+
+// The variant of `variants` for the current toggles
+void Renderer::dispatch(
+    ComputeVariants& variants, RenderPass pass, MemoryBarrierMask barriers,
+    WavefrontMode mode
+) {
+    auto& current = variant(variants);
+    dispatch(current.second, pass, barriers, mode, is_specialized(current));
+}
+
+// Each iteration reads `reservoirs` and writes `spatial_reservoirs`, then the
+// two are swapped so that later passes and iterations see the result. The
+// pass stages a tile and its apron, so it always covers the whole image even
+// in wavefront mode.
+void Renderer::spatial_reuse_passes() {
+    gpu_timers.begin(pass_spatial_reuse);
+
+    for (int i = 0; i < spatial_iterations; i++) {
+        auto& current = variant(micro_restir_spatial_reuse);
+        current.second.use();
+        bind_everything(is_specialized(current));
+        glUniform1i(39, i);
+        glUniform1i(45, pass_spatial_reuse);
+        glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        std::swap(reservoirs, spatial_reservoirs);
+    }
+
+    gpu_timers.end();
+}
+
+// Reads back the counters of the last frame. One row per pixel, and one per
+// level of the step histogram.
+void Renderer::write_traversal_stats(
+    const std::filesystem::path& pixels_path,
+    const std::filesystem::path& levels_path
+) {
+    if (!traversal_stats.owns()) {
+        return;
+    }
+
+    std::vector<glm::uvec4> pixels(width * height);
+    glGetNamedBufferSubData(
+        traversal_stats.get(), sizeof(TraversalTotals),
+        pixels.size() * sizeof(glm::uvec4), pixels.data()
+    );
+
+    std::ofstream pixels_file(pixels_path);
+    pixels_file << "x,y,steps,fetches,capped,rays\n";
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            glm::uvec4 p = pixels[y * width + x];
+            pixels_file << std::format(
+                "{},{},{},{},{},{}\n", x, y, p.x, p.y, p.z, p.w
+            );
+        }
+    }
+
+    std::ofstream levels_file(levels_path);
+    levels_file << "level,steps\n";
+    for (size_t i = 0; i < traversal_levels; i++) {
+        levels_file << std::format(
+            "{},{}\n", i, last_traversal_totals.level_steps[i]
+        );
+    }
+
+    if (!pixels_file || !levels_file) {
+        SPDLOG_ERROR(
+            "Could not write {} or {}", pixels_path.string(),
+            levels_path.string()
+        );
+    }
+}
+
+// Picks the first few distinct models in instance order, whose top nodes
+// every traversal pass then keeps in shared memory
+void Renderer::select_cached_models() {
+    cached_model_count = 0;
+
+    for (auto& instance : metadata_ssbo.data) {
+        if (cached_model_count == max_cached_models) {
+            break;
+        }
+
+        bool seen = false;
+        for (int i = 0; i < cached_model_count; i++) {
+            seen = seen || cached_models[i] == instance.at_index;
+        }
+
+        if (!seen) {
+            cached_models[cached_model_count] = instance.at_index;
+            cached_model_sizes[cached_model_count] =
+                model_sizes[instance.at_index];
+            cached_model_count++;
+        }
+    }
+}
+
+void Renderer::bin_instances() {
+    uint32_t n_models = metadata_ssbo.data.size();
+    uint32_t tiles_x = (width + bin_tile_size - 1) / bin_tile_size;
+    uint32_t tiles_y = (height + bin_tile_size - 1) / bin_tile_size;
+
+    glClearNamedBufferData(
+        bin_stats.get(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr
+    );
+
+    gpu_timers.begin(pass_bin_instances);
+
+    instance_projection.use();
+    bind_everything();
+    glDispatchCompute((n_models + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    tile_binning.use();
+    bind_everything();
+    glDispatchCompute(tiles_x, tiles_y, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    gpu_timers.end();
+
+    if (show_bin_stats) {
+        // Stalls until binning finishes; Only meant for tuning
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glGetNamedBufferSubData(
+            bin_stats.get(), 0, sizeof(TileBinStats), &last_bin_stats
+        );
+    }
+}
+
+// Starts meshing the trees of register_mesh_source() off the render thread,
+// spread over workers, and registers the meshes that are done
+void Renderer::collect_meshes() {
+    for (auto& [model_id, svodag] : mesh_sources) {
+        if (!pending_meshes.contains(model_id)) {
+            pending_meshes.emplace(
+                model_id, std::async(std::launch::async, [this, svodag]() {
+                    return mesh_greedy(svodag, &workers);
+                })
+            );
+        }
+    }
+
+    for (auto it = pending_meshes.begin(); it != pending_meshes.end();) {
+        auto& [model_id, mesh] = *it;
+        if (mesh.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+            it++;
+            continue;
+        }
+
+        std::vector<MeshQuad> quads = mesh.get();
+        register_mesh(model_id, quads);
+        SPDLOG_INFO("Mesh quads: {}", quads.size());
+
+        mesh_sources.erase(model_id);
+        it = pending_meshes.erase(it);
+    }
+}
+
+void Renderer::rasterize_ray_start() {
+    const float inf = std::numeric_limits<float>::infinity();
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    ray_start_fbo.bind();
+    glViewport(0, 0, width, height);
+    gpu_timers.begin(pass_ray_start);
+    glClearNamedFramebufferfv(ray_start_fbo.get(), GL_COLOR, 0, &inf);
+
+    // Only the nearest entry distance per pixel is kept
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_MIN);
+
+    box_depth.use();
+    metadata_ssbo.bind(2);
+
+    glm::vec3 x_basis = camera.camera_x_basis();
+    glm::vec3 y_basis = camera.camera_y_basis();
+    glm::vec3 pos = camera.get_pos();
+    glm::vec3 dir = camera.get_dir();
+
+    glUniform3fv(1, 1, glm::value_ptr(pos));
+    glUniform3fv(2, 1, glm::value_ptr(dir));
+    glUniform3fv(5, 1, glm::value_ptr(x_basis));
+    glUniform3fv(4, 1, glm::value_ptr(y_basis));
+    glUniform1i(15, width);
+    glUniform1i(16, height);
+
+    vao.bind();
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, metadata_ssbo.data.size());
+    gpu_timers.end();
+
+    glBlendEquation(GL_FUNC_ADD);
+    glDisable(GL_BLEND);
+
+    Framebuffer::bind_default();
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+// Draws the greedy mesh of every instance with the same projection as the
+// primary rays, keeping the nearest surface per pixel for 0_first_hit.comp
+void Renderer::rasterize_gbuffer() {
+    const std::array<float, 4> miss = {
+        std::numeric_limits<float>::infinity(), 0.0f, 0.0f, 0.0f
+    };
+    const float far_depth = 0.0f;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    gbuffer_fbo.bind();
+    glViewport(0, 0, width, height);
+    gpu_timers.begin(pass_raster_gbuffer);
+    glClearNamedFramebufferfv(gbuffer_fbo.get(), GL_COLOR, 0, miss.data());
+    glClearNamedFramebufferfv(gbuffer_fbo.get(), GL_DEPTH, 0, &far_depth);
+
+    // Reversed depth, see mesh_gbuffer.vert
+    glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_GREATER);
+
+    mesh_gbuffer.use();
+    metadata_ssbo.bind(2);
+    mesh_quads.bind(23);
+
+    glm::vec3 x_basis = camera.camera_x_basis();
+    glm::vec3 y_basis = camera.camera_y_basis();
+    glm::vec3 pos = camera.get_pos();
+    glm::vec3 dir = camera.get_dir();
+
+    glUniform3fv(1, 1, glm::value_ptr(pos));
+    glUniform3fv(2, 1, glm::value_ptr(dir));
+    glUniform3fv(5, 1, glm::value_ptr(x_basis));
+    glUniform3fv(4, 1, glm::value_ptr(y_basis));
+    glUniform1i(15, width);
+    glUniform1i(16, height);
+
+    vao.bind();
+    for (size_t i = 0; i < metadata_ssbo.data.size(); i++) {
+        auto [first_quad, quad_count] =
+            mesh_ranges.at(metadata_ssbo.data[i].at_index);
+
+        glUniform1ui(52, i);
+        glUniform1ui(53, first_quad);
+        glDrawArrays(GL_TRIANGLES, 0, 6 * quad_count);
+    }
+    gpu_timers.end();
+
+    glDepthFunc(GL_LESS);
+    glDisable(GL_DEPTH_TEST);
+    glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+
+    Framebuffer::bind_default();
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 }
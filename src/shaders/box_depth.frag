@@ -0,0 +1,51 @@
+#version 450 core
+
+layout(location = 1) uniform vec3 camera_pos;
+layout(location = 2) uniform vec3 camera_dir;
+layout(location = 5) uniform vec3 camera_right;
+layout(location = 4) uniform vec3 camera_up;
+layout(location = 15) uniform int width;
+layout(location = 16) uniform int height;
+
+layout(location = 0) flat in uint instance;
+
+layout(location = 0) out float ray_start;
+
+struct SvodagMetaData {
+    mat4 model_inv;
+    mat4 model;
+    mat4 model_norm;
+    mat4 prev_model;
+    uint max_level;
+    uint at_index;
+    uint occupancy_at_index;
+};
+
+layout(std430, binding = 2) buffer two {
+    SvodagMetaData metadata[];
+};
+
+// Writes the distance along the primary ray at which it enters the instance's
+// bounds. Blending with GL_MIN keeps the nearest one.
+void main() {
+    vec2 frag_pos = (gl_FragCoord.xy - 0.5) / vec2(width, height) * 2.0 - 1.0;
+    vec3 dir = normalize(frag_pos.x * camera_right + frag_pos.y * camera_up + camera_dir);
+
+    // Not normalized, so that t stays in world space units
+    mat4 model_inv_mat = metadata[instance].model_inv;
+    vec3 origin_modelsp = (model_inv_mat * vec4(camera_pos, 1.0)).xyz;
+    vec3 dir_inv_modelsp = 1.0 / (model_inv_mat * vec4(dir, 0.0)).xyz;
+
+    vec3 t1 = (vec3(0.0) - origin_modelsp) * dir_inv_modelsp;
+    vec3 t2 = (vec3(1.0) - origin_modelsp) * dir_inv_modelsp;
+    vec3 tminvec = min(t1, t2);
+    vec3 tmaxvec = max(t1, t2);
+
+    float tmin = max(tminvec.x, max(tminvec.y, tminvec.z));
+    float tmax = min(tmaxvec.x, min(tmaxvec.y, tmaxvec.z));
+
+    // The fragments box_depth.vert dilates the bounds by miss them, as can
+    // silhouettes where the rasterizer and the slab test disagree; Start at
+    // the camera rather than skipping the pixel
+    ray_start = tmax >= tmin ? max(tmin, 0.0) : 0.0;
+}
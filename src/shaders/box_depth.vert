@@ -0,0 +1,82 @@
+#version 450 core
+
+layout(location = 1) uniform vec3 camera_pos;
+layout(location = 2) uniform vec3 camera_dir;
+layout(location = 5) uniform vec3 camera_right;
+layout(location = 4) uniform vec3 camera_up;
+layout(location = 15) uniform int width;
+layout(location = 16) uniform int height;
+
+layout(location = 0) flat out uint instance;
+
+struct SvodagMetaData {
+    mat4 model_inv;
+    mat4 model;
+    mat4 model_norm;
+    mat4 prev_model;
+    uint max_level;
+    uint at_index;
+    uint occupancy_at_index;
+};
+
+layout(std430, binding = 2) buffer two {
+    SvodagMetaData metadata[];
+};
+
+// Corners are numbered as in instance_projection.comp: bit 2 = x, 1 = y, 0 = z
+const uint cube_indices[36] = uint[](
+        0, 1, 3, 0, 3, 2, // -x
+        4, 6, 7, 4, 7, 5, // +x
+        0, 4, 5, 0, 5, 1, // -y
+        2, 3, 7, 2, 7, 6, // +y
+        0, 2, 6, 0, 6, 4, // -z
+        1, 5, 7, 1, 7, 3 // +z
+    );
+
+vec4 project(vec3 pos_modelsp) {
+    vec3 v = (metadata[gl_InstanceID].model * vec4(pos_modelsp, 1.0)).xyz - camera_pos;
+
+    // z = 0 keeps everything in front of the camera inside the clip volume
+    // and clips away what is behind it
+    return vec4(
+        dot(v, camera_right) / dot(camera_right, camera_right),
+        dot(v, camera_up) / dot(camera_up, camera_up),
+        0.0,
+        dot(v, camera_dir)
+    );
+}
+
+// Draws the unit cube of every instance with the same projection that
+// 0_first_hit.comp uses to generate primary rays.
+void main() {
+    uint corner = cube_indices[gl_VertexID];
+    vec3 corner_modelsp = vec3((corner >> 2) & 1, (corner >> 1) & 1, corner & 1);
+
+    gl_Position = project(corner_modelsp);
+
+    // Rasterization is not conservative, so a ray that only grazes the
+    // bounds, or enters bounds thinner than a pixel, could get no fragment
+    // and be skipped as sky. Pushing every corner in front of the camera a
+    // pixel away from the center of those corners dilates the bounds by a
+    // pixel, and box_depth.frag starts the extra fragments at the camera.
+    vec2 center = vec2(0.0);
+    float in_front = 0.0;
+    for (uint i = 0; i < 8; i++) {
+        vec4 p = project(vec3((i >> 2) & 1, (i >> 1) & 1, i & 1));
+        if (p.w > 0.0) {
+            center += p.xy / p.w;
+            in_front += 1.0;
+        }
+    }
+
+    if (gl_Position.w > 0.0) {
+        vec2 away = sign(gl_Position.xy / gl_Position.w - center / in_front);
+        gl_Position.xy += away * 2.0 * gl_Position.w / vec2(width, height);
+    }
+
+    // Rays are generated at integer pixel coordinates while fragments are
+    // shaded at pixel centers, so shift by half a pixel
+    gl_Position.xy += gl_Position.w / vec2(width, height);
+
+    instance = gl_InstanceID;
+}
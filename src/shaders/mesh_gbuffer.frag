@@ -0,0 +1,16 @@
+#version 450 core
+
+layout(location = 1) uniform vec3 camera_pos;
+layout(location = 52) uniform uint instance;
+
+layout(location = 0) in vec3 pos_worldsp;
+layout(location = 1) flat in uint face;
+
+layout(location = 0) out vec4 gbuffer;
+
+// Distance along the primary ray, instance and model space face of the
+// nearest surface, which 0_first_hit.comp reads instead of marching. The
+// depth test keeps the nearest one.
+void main() {
+    gbuffer = vec4(length(pos_worldsp - camera_pos), float(instance), float(face), 0.0);
+}
@@ -0,0 +1,82 @@
+#version 450 core
+
+layout(location = 1) uniform vec3 camera_pos;
+layout(location = 2) uniform vec3 camera_dir;
+layout(location = 5) uniform vec3 camera_right;
+layout(location = 4) uniform vec3 camera_up;
+layout(location = 15) uniform int width;
+layout(location = 16) uniform int height;
+layout(location = 52) uniform uint instance;
+layout(location = 53) uniform uint first_quad;
+
+layout(location = 0) out vec3 pos_worldsp;
+layout(location = 1) flat out uint face;
+
+struct SvodagMetaData {
+    mat4 model_inv;
+    mat4 model;
+    mat4 model_norm;
+    mat4 prev_model;
+    uint max_level;
+    uint at_index;
+    uint occupancy_at_index;
+};
+
+layout(std430, binding = 2) buffer two {
+    SvodagMetaData metadata[];
+};
+
+// Matches MeshQuad in mesher.hpp
+struct MeshQuad {
+    uint origin[3];
+    uint width;
+    uint height;
+    uint face;
+    uint mat_id;
+};
+
+layout(std430, binding = 23) readonly buffer mesh_quads_buf {
+    MeshQuad mesh_quads[];
+};
+
+// Two triangles per quad, over the corners in (width, height) units
+const vec2 quad_corners[6] = vec2[](
+        vec2(0, 0), vec2(1, 0), vec2(1, 1),
+        vec2(0, 0), vec2(1, 1), vec2(0, 1)
+    );
+
+// Draws the greedy mesh of one instance, pulling the quads of its model
+// starting at first_quad, with the projection of box_depth.vert
+void main() {
+    MeshQuad quad = mesh_quads[first_quad + gl_VertexID / 6];
+    vec2 corner = quad_corners[gl_VertexID % 6];
+
+    uint axis = quad.face / 2;
+    vec3 corner_voxels = vec3(quad.origin[0], quad.origin[1], quad.origin[2]);
+    corner_voxels[(axis + 1) % 3] += corner.x * float(quad.width);
+    corner_voxels[(axis + 2) % 3] += corner.y * float(quad.height);
+
+    SvodagMetaData m = metadata[instance];
+    vec3 corner_modelsp = corner_voxels / float(1u << m.max_level);
+    pos_worldsp = (m.model * vec4(corner_modelsp, 1.0)).xyz;
+
+    vec3 v = pos_worldsp - camera_pos;
+    float view_depth = dot(v, camera_dir);
+
+    // Reversed depth NEAR / view_depth, drawn with glClipControl's
+    // GL_ZERO_TO_ONE so that floats keep their precision at any distance.
+    // Everything closer than NEAR is clipped away.
+    const float NEAR = 0.001;
+    gl_Position = vec4(
+            dot(v, camera_right) / dot(camera_right, camera_right),
+            dot(v, camera_up) / dot(camera_up, camera_up),
+            NEAR,
+            view_depth
+        );
+
+    // Rays are generated at integer pixel coordinates while fragments are
+    // shaded at pixel centers, so shift by half a pixel
+    gl_Position.xy += gl_Position.w / vec2(width, height);
+
+    face = quad.face;
+}
@@ -1,7 +1,14 @@
 #include "svodag.hpp"
 #include "formatter.hpp"
 #include "spdlog/spdlog.h"
-
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
 #include <utility>
 
 size_t bitmask_to_index(
@@ -111,6 +118,10 @@ SvoNode::get_children() const noexcept {
     return children;
 }
 
+const SvoNode* SvoNode::get_child(const size_t index) const noexcept {
+    return children[index].get();
+}
+
 const std::optional<QueryResult> SvoNode::query(
     const size_t x_bitmask, const size_t y_bitmask, const size_t z_bitmask,
     const size_t level
@@ -138,6 +149,237 @@ const std::optional<QueryResult> SvoNode::query(
     }
 }
 
+namespace {
+// Same order as bitmask_to_index()
+Aabb octant(const Aabb& cell, size_t index) {
+    glm::vec3 half = cell.extent() * 0.5f;
+    glm::vec3 offset((index >> 2) & 1, (index >> 1) & 1, index & 1);
+    glm::vec3 min = cell.min + half * offset;
+
+    return Aabb{min, min + half};
+}
+
+typedef struct {
+    float t;
+    int axis; // -1 if the box starts out overlapping on no moving axis
+} SweepEntry;
+
+// When the box moving along velocity over t in [0, 1] starts to overlap
+// cell, from the overlap of every axis as an interval of t
+std::optional<SweepEntry>
+sweep_entry(const Aabb& box, const glm::vec3 velocity, const Aabb& cell) {
+    float enter = -std::numeric_limits<float>::infinity();
+    float exit = std::numeric_limits<float>::infinity();
+    int axis = -1;
+
+    for (int i = 0; i < 3; i++) {
+        // Overlapping while the offset along the axis is within (lo, hi)
+        float lo = cell.min[i] - box.max[i];
+        float hi = cell.max[i] - box.min[i];
+
+        if (velocity[i] == 0.0f) {
+            if (!(lo < 0.0f && 0.0f < hi)) {
+                return std::nullopt;
+            }
+
+            continue;
+        }
+
+        float t0 = lo / velocity[i];
+        float t1 = hi / velocity[i];
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+
+        if (t0 > enter) {
+            enter = t0;
+            axis = i;
+        }
+        exit = std::min(exit, t1);
+    }
+
+    if (enter >= exit || enter > 1.0f || exit <= 0.0f) {
+        return std::nullopt;
+    }
+
+    return SweepEntry{std::max(enter, 0.0f), axis};
+}
+} // namespace
+
+bool SvoNode::overlaps(const Aabb& cell, const Aabb& box) const noexcept {
+    if (!children[0]) {
+        return mat_id != 0;
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+        Aabb child_cell = octant(cell, i);
+
+        if (child_cell.overlaps(box) &&
+            children[i]->overlaps(child_cell, box)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void SvoNode::collect_solid(
+    const Aabb& cell, const Aabb& box, std::vector<SolidCell>& out
+) const {
+    if (!children[0]) {
+        if (mat_id != 0) {
+            out.push_back(SolidCell{cell, mat_id});
+        }
+
+        return;
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+        Aabb child_cell = octant(cell, i);
+
+        if (child_cell.overlaps(box)) {
+            children[i]->collect_solid(child_cell, box, out);
+        }
+    }
+}
+
+void SvoNode::sweep(
+    const Aabb& cell, const Aabb& box, const glm::vec3 velocity,
+    SweepResult& nearest
+) const noexcept {
+    if (!children[0]) {
+        if (mat_id == 0) {
+            return;
+        }
+
+        auto entry = sweep_entry(box, velocity, cell);
+        if (entry && entry->t < nearest.t) {
+            nearest.t = entry->t;
+            nearest.normal = glm::vec3(0.0f);
+            if (entry->axis >= 0) {
+                nearest.normal[entry->axis] =
+                    velocity[entry->axis] > 0.0f ? -1.0f : 1.0f;
+            }
+            nearest.mat_id = mat_id;
+        }
+
+        return;
+    }
+
+    // Nearest octants first, so that farther ones are mostly culled by
+    // nearest.t
+    std::array<std::pair<float, size_t>, 8> order;
+    size_t count = 0;
+    for (size_t i = 0; i < 8; i++) {
+        auto entry = sweep_entry(box, velocity, octant(cell, i));
+
+        if (entry) {
+            order[count++] = {entry->t, i};
+        }
+    }
+
+    std::sort(order.begin(), order.begin() + count);
+
+    for (size_t k = 0; k < count; k++) {
+        auto [t, i] = order[k];
+        if (t >= nearest.t) {
+            break;
+        }
+
+        children[i]->sweep(octant(cell, i), box, velocity, nearest);
+    }
+}
+
+namespace {
+// The part of box that the cube of edge 2^level at origin covers
+VoxelBox clip(const VoxelBox& box, const glm::uvec3 origin, size_t level) {
+    return VoxelBox{
+        glm::max(box.min, origin),
+        glm::min(box.max, origin + glm::uvec3(1u << level))
+    };
+}
+
+bool is_empty(const VoxelBox& box) {
+    return box.min.x >= box.max.x || box.min.y >= box.max.y ||
+           box.min.z >= box.max.z;
+}
+
+size_t voxel_index(const VoxelBox& box, const glm::uvec3 pos) {
+    glm::uvec3 size = box.max - box.min;
+    glm::uvec3 offset = pos - box.min;
+
+    return (size_t(offset.z) * size.y + offset.y) * size.x + offset.x;
+}
+
+void fill_part(
+    const VoxelBox& box, const VoxelBox& part, std::span<MatID_t> out,
+    MatID_t mat_id
+) {
+    size_t row = part.max.x - part.min.x;
+
+    for (uint32_t z = part.min.z; z < part.max.z; z++) {
+        for (uint32_t y = part.min.y; y < part.max.y; y++) {
+            size_t start = voxel_index(box, glm::uvec3(part.min.x, y, z));
+            std::fill_n(out.begin() + start, row, mat_id);
+        }
+    }
+}
+
+// Copies the cube of edge `edge` at `from` onto the one at `to`
+void copy_cube(
+    const VoxelBox& box, std::span<MatID_t> out, const glm::uvec3 from,
+    const glm::uvec3 to, uint32_t edge
+) {
+    for (uint32_t z = 0; z < edge; z++) {
+        for (uint32_t y = 0; y < edge; y++) {
+            glm::uvec3 row(0u, y, z);
+            std::copy_n(
+                out.begin() + voxel_index(box, from + row), edge,
+                out.begin() + voxel_index(box, to + row)
+            );
+        }
+    }
+}
+} // namespace
+
+void SvoNode::extract(
+    const glm::uvec3 origin, const size_t level, const VoxelBox& box,
+    std::span<MatID_t> out, ExtractMemo& memo
+) const noexcept {
+    VoxelBox part = clip(box, origin, level);
+    if (is_empty(part)) {
+        return;
+    }
+
+    if (!children[0]) {
+        // out starts out empty
+        if (mat_id != 0) {
+            fill_part(box, part, out, mat_id);
+        }
+
+        return;
+    }
+
+    uint32_t edge = 1u << level;
+
+    // Copying cubes of 2^3 costs about as much as descending into them
+    if (level >= 2 && part.min == origin &&
+        part.max == origin + glm::uvec3(edge)) {
+        auto [first, inserted] = memo[level].try_emplace(this, origin);
+
+        if (!inserted) {
+            copy_cube(box, out, first->second, origin, edge);
+            return;
+        }
+    }
+
+    uint32_t half = edge / 2;
+    for (size_t i = 0; i < 8; i++) {
+        glm::uvec3 offset((i >> 2) & 1, (i >> 1) & 1, i & 1);
+        children[i]->extract(origin + offset * half, level - 1, box, out, memo);
+    }
+}
+
 SvoDag::SvoDag() noexcept
     : root(std::make_shared<SvoNode>()), level(8 /*2^8^3 = 256^3 voxels*/) {};
 SvoDag::SvoDag(size_t level) noexcept
@@ -207,6 +449,89 @@ const std::vector<SerializedNode> SvoDag::serialize() const noexcept {
     return buffer;
 }
 
+namespace {
+typedef std::vector<std::unordered_map<const SvoNode*, Addr_t>> OccupancyMemo;
+
+Addr_t serialize_occupancy_node(
+    const std::shared_ptr<SvoNode>& node, size_t level,
+    std::vector<OccupancyNode>& nodes,
+    std::unordered_map<OccupancyNode, Addr_t>& unique, OccupancyMemo& memo
+) {
+    auto children = node->get_children();
+
+    if (!children[0]) {
+        return node->get_mat_id() != 0 ? occupancy_solid : occupancy_empty;
+    }
+
+    // Deduplicated subtrees are shared, so each is only visited once
+    auto visited = memo[level].find(node.get());
+    if (visited != memo[level].end()) {
+        return visited->second;
+    }
+
+    Addr_t result;
+
+    if (level == 1) {
+        Addr_t mask = 0;
+        for (int i = 0; i < 8; i++) {
+            mask |= Addr_t(children[i]->get_mat_id() != 0) << i;
+        }
+
+        result = mask == 0xFF ? occupancy_solid
+                 : mask == 0  ? occupancy_empty
+                              : occupancy_brick | mask;
+    } else {
+        OccupancyNode encoded;
+        for (int i = 0; i < 8; i++) {
+            encoded.child[i] = serialize_occupancy_node(
+                children[i], level - 1, nodes, unique, memo
+            );
+        }
+
+        auto all = [&](Addr_t value) {
+            return std::ranges::all_of(encoded.child, [&](Addr_t child) {
+                return child == value;
+            });
+        };
+
+        if (all(occupancy_solid)) {
+            result = occupancy_solid;
+        } else if (all(occupancy_empty)) {
+            result = occupancy_empty;
+        } else if (auto existing = unique.find(encoded);
+                   existing != unique.end()) {
+            result = existing->second;
+        } else {
+            result = nodes.size();
+            nodes.push_back(encoded);
+            unique.emplace(encoded, result);
+        }
+    }
+
+    memo[level].emplace(node.get(), result);
+
+    return result;
+}
+} // namespace
+
+const std::vector<OccupancyNode> SvoDag::serialize_occupancy() const noexcept {
+    std::vector<OccupancyNode> nodes(1); // Reserve the root
+    std::unordered_map<OccupancyNode, Addr_t> unique;
+    OccupancyMemo memo(level + 1);
+
+    auto children = root->get_children();
+    for (int i = 0; i < 8; i++) {
+        nodes[0].child[i] =
+            children[i] ? serialize_occupancy_node(
+                              children[i], level - 1, nodes, unique, memo
+                          )
+            : root->get_mat_id() != 0 ? occupancy_solid
+                                      : occupancy_empty;
+    }
+
+    return nodes;
+}
+
 std::tuple<size_t, size_t, size_t>
 pos_to_bitmask(const glm::vec3 pos, size_t level) noexcept {
     return std::make_tuple<size_t, size_t, size_t>(
@@ -244,6 +569,108 @@ const QueryResult SvoDag::query(const glm::vec3 pos) const noexcept {
     return result.value_or({root, level});
 }
 
+// The tree spans (0, 0, 0) ~ (1, 1, 1)
+bool SvoDag::overlaps(const Aabb& box) const noexcept {
+    Aabb cell{glm::vec3(0.0f), glm::vec3(1.0f)};
+
+    return cell.overlaps(box) && root->overlaps(cell, box);
+}
+
+void SvoDag::collect_solid(
+    const Aabb& box, std::vector<SolidCell>& out
+) const {
+    Aabb cell{glm::vec3(0.0f), glm::vec3(1.0f)};
+
+    if (cell.overlaps(box)) {
+        root->collect_solid(cell, box, out);
+    }
+}
+
+const SweepResult
+SvoDag::sweep(const Aabb& box, const glm::vec3 velocity) const noexcept {
+    Aabb cell{glm::vec3(0.0f), glm::vec3(1.0f)};
+    SweepResult nearest{1.0f, glm::vec3(0.0f), 0};
+
+    if (sweep_entry(box, velocity, cell)) {
+        root->sweep(cell, box, velocity, nearest);
+    }
+
+    return nearest;
+}
+
+void SvoDag::extract(
+    const VoxelBox& box, std::span<MatID_t> out, ThreadPool* pool
+) const {
+    if (glm::any(glm::lessThan(box.max, box.min))) {
+        SPDLOG_ERROR("Cannot extract a box that ends before it starts");
+        throw std::runtime_error(
+            "Cannot extract a box that ends before it starts"
+        );
+    }
+
+    glm::uvec3 size = box.max - box.min;
+    size_t volume = size_t(size.x) * size.y * size.z;
+
+    if (out.size() != volume) {
+        SPDLOG_ERROR("{} voxels were extracted into {}", volume, out.size());
+        throw std::runtime_error(
+            std::format("{} voxels were extracted into {}", volume, out.size())
+        );
+    }
+
+    std::fill(out.begin(), out.end(), 0);
+
+    // Descends while the box lies within a single octant, then hands out the
+    // octants the box spans
+    typedef std::tuple<std::shared_ptr<SvoNode>, glm::uvec3, size_t> Part;
+    std::vector<Part> parts = {{root, glm::uvec3(0u), level}};
+
+    while (parts.size() == 1) {
+        auto [node, origin, node_level] = parts[0];
+        auto children = node->get_children();
+
+        if (!children[0]) {
+            break;
+        }
+
+        parts.clear();
+        uint32_t half = 1u << (node_level - 1);
+        for (size_t i = 0; i < 8; i++) {
+            glm::uvec3 offset((i >> 2) & 1, (i >> 1) & 1, i & 1);
+            glm::uvec3 child_origin = origin + offset * half;
+
+            if (!is_empty(clip(box, child_origin, node_level - 1))) {
+                parts.push_back({children[i], child_origin, node_level - 1});
+            }
+        }
+    }
+
+    if (pool == nullptr || pool->size() == 0 || parts.size() <= 1 ||
+        volume <= extract_parallel_volume) {
+        ExtractMemo memo(level + 1);
+        for (auto& [node, origin, node_level] : parts) {
+            node->extract(origin, node_level, box, out, memo);
+        }
+
+        return;
+    }
+
+    // The octants write disjoint parts of out, and each copies only from
+    // its own part
+    std::vector<std::future<void>> done;
+    for (auto& part : parts) {
+        done.push_back(pool->submit([&]() {
+            auto& [node, origin, node_level] = part;
+            ExtractMemo memo(level + 1);
+            node->extract(origin, node_level, box, out, memo);
+        }));
+    }
+
+    for (auto& future : done) {
+        future.get();
+    }
+}
+
 void SvoDag::dedup() noexcept {
     std::unordered_map<SvoNode, std::shared_ptr<SvoNode>> map{};
     for (int i = level - 1; i >= 0; i--) {
@@ -332,3 +759,13 @@ size_t std::hash<SvoNode>::operator()(const SvoNode& node) const noexcept {
 
     return h1 ^ (h2 << 1);
 }
+
+size_t std::hash<OccupancyNode>::operator()(const OccupancyNode& node
+) const noexcept {
+    size_t h = 0;
+    for (Addr_t child : node.child) {
+        h = h * 31 + std::hash<Addr_t>{}(child);
+    }
+
+    return h;
+}
@@ -1,5 +1,7 @@
 #include "texture.hpp"
 
+#include <algorithm>
+
 Texture::~Texture() noexcept { gl::glDeleteTextures(1, &texture); }
 
 Texture::Texture(Texture&& other) noexcept : texture(other.texture) {
@@ -33,3 +35,34 @@ void Texture::parameterf(gl::GLenum property_name, gl::GLfloat parameter) {
 
 Texture2D::Texture2D() noexcept : Texture{} {};
 CubeMap::CubeMap() noexcept : Texture{} {};
+
+CubeMap::CubeMap(
+    const std::array<MipChain, 6>& faces, gl::GLenum internal_format,
+    gl::GLsizei levels
+) {
+    using namespace gl;
+
+    levels = std::min(levels, faces[0].get_levels());
+
+    glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &texture);
+
+    glTextureStorage2D(
+        texture, levels, internal_format, faces[0].get_width(),
+        faces[0].get_width()
+    );
+
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    for (GLsizei level = 0; level < levels; level++) {
+        GLsizei width = faces[0].get_width(level);
+
+        for (int face = 0; face < 6; face++) {
+            glTextureSubImage3D(
+                texture, level, 0, 0, face, width, width, 1, GL_RGBA,
+                GL_UNSIGNED_BYTE, faces[face].level(level).data()
+            );
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int thread_count) : stopping(false) {
+    // hardware_concurrency() may not know
+    thread_count = std::max(thread_count, 1u);
+
+    for (unsigned int i = 0; i < thread_count; i++) {
+        threads.emplace_back([this]() { work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() noexcept {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+
+        {
+            std::unique_lock lock(mutex);
+            condition.wait(lock, [this]() {
+                return stopping || !tasks.empty();
+            });
+
+            // Drain what is left before leaving
+            if (tasks.empty()) {
+                return;
+            }
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+
+        task();
+    }
+}
@@ -2,19 +2,30 @@
 
 #include <glbinding/glbinding.h>
 
+#include <spdlog/spdlog.h>
+
 #include <utility>
 
-Window::Window(int width, int height, const char* name) noexcept
+Window::Window(int width, int height, const char* name, bool visible) noexcept
     : width(width), height(height) {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifndef NDEBUG
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
 
     glfwWindowHint(GLFW_SCALE_TO_MONITOR, GLFW_TRUE);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
     window = glfwCreateWindow(width, height, name, NULL, NULL);
 
+    if (!window) {
+        SPDLOG_CRITICAL("Could not create a window with an OpenGL 4.5 context");
+        exit(1);
+    }
+
     glfwMakeContextCurrent(window);
     glfwSwapInterval(0);
 
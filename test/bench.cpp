@@ -0,0 +1,270 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "include/cpu_raymarch.hpp"
+#include "include/svodag.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+// Timings come from Catch2's reporters, e.g. `-r xml` or `-r json`. Derived
+// numbers such as the dedup ratio go to bench_metrics.csv in the working
+// directory.
+//
+// Every content type is capped at a few hundred thousand voxels, so that
+// deep trees are sparse rather than slow to build:
+// - shell: hollow sphere of radius min(size / 2 - 1, 128), one voxel thick
+// - terrain: two voxel thick heightfield over a min(size, 256)^2 footprint
+// - random: min(size^3 / 8, 200000) voxels spread over the whole tree
+// - solid: cube with an edge of min(size, 64) in a corner
+
+namespace {
+typedef std::array<uint32_t, 4> Voxel; // x, y, z, material
+
+const std::array<const char*, 4> contents = {
+    "shell", "terrain", "random", "solid"
+};
+
+std::vector<Voxel> generate(const std::string& content, size_t depth) {
+    const int64_t size = int64_t(1) << depth;
+    std::vector<Voxel> voxels;
+
+    if (content == "shell") {
+        int64_t c = size / 2;
+        int64_t r = std::min<int64_t>(size / 2 - 1, 128);
+
+        for (int64_t x = c - r - 1; x <= c + r; x++) {
+            for (int64_t y = c - r - 1; y <= c + r; y++) {
+                for (int64_t z = c - r - 1; z <= c + r; z++) {
+                    int64_t d = (x - c) * (x - c) + (y - c) * (y - c) +
+                                (z - c) * (z - c);
+                    if ((r - 1) * (r - 1) < d && d <= r * r) {
+                        voxels.push_back(
+                            {uint32_t(x), uint32_t(y), uint32_t(z), 1}
+                        );
+                    }
+                }
+            }
+        }
+    } else if (content == "terrain") {
+        int64_t footprint = std::min<int64_t>(size, 256);
+
+        for (int64_t x = 0; x < footprint; x++) {
+            for (int64_t z = 0; z < footprint; z++) {
+                // Octaves of sines stand in for noise, deterministically
+                float h = 0.0f;
+                for (int octave = 0; octave < 4; octave++) {
+                    float f = float(1 << octave) * 6.2831853f / footprint;
+                    h += std::sin(x * f * 1.3f + octave) *
+                         std::cos(z * f * 0.7f + 2.0f * octave) /
+                         float(1 << octave);
+                }
+
+                int64_t y = int64_t((h * 0.25f + 0.5f) * (footprint - 2));
+                for (int64_t dy = 0; dy < 2; dy++) {
+                    voxels.push_back(
+                        {uint32_t(x), uint32_t(y + dy), uint32_t(z),
+                         uint32_t(1 + dy)}
+                    );
+                }
+            }
+        }
+    } else if (content == "random") {
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<uint32_t> coord(0, size - 1);
+        std::uniform_int_distribution<uint32_t> material(1, 4);
+        int64_t count = std::min<int64_t>(size * size * size / 8, 200000);
+
+        for (int64_t i = 0; i < count; i++) {
+            uint32_t x = coord(gen);
+            uint32_t y = coord(gen);
+            uint32_t z = coord(gen);
+            voxels.push_back({x, y, z, material(gen)});
+        }
+    } else if (content == "solid") {
+        uint32_t edge = std::min<int64_t>(size, 64);
+
+        for (uint32_t x = 0; x < edge; x++) {
+            for (uint32_t y = 0; y < edge; y++) {
+                for (uint32_t z = 0; z < edge; z++) {
+                    voxels.push_back({x, y, z, 1});
+                }
+            }
+        }
+    }
+
+    return voxels;
+}
+
+SvoDag build(const std::vector<Voxel>& voxels, size_t depth) {
+    SvoDag svodag{depth};
+    for (auto [x, y, z, material] : voxels) {
+        svodag.insert(x, y, z, material);
+    }
+
+    return svodag;
+}
+
+void record(
+    const std::string& content, size_t depth, const std::string& metric,
+    double value
+) {
+    static std::ofstream file = []() {
+        std::ofstream f("bench_metrics.csv");
+        f << "content,depth,metric,value\n";
+        return f;
+    }();
+
+    file << std::format("{},{},{},{}\n", content, depth, metric, value);
+    file.flush();
+}
+
+std::vector<glm::vec3> query_positions() {
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+
+    std::vector<glm::vec3> positions(1024);
+    for (auto& pos : positions) {
+        pos = glm::vec3(dis(gen), dis(gen), dis(gen));
+    }
+
+    return positions;
+}
+
+// A 64x64 pinhole camera looking at the tree from the -x side
+std::vector<Ray> camera_rays() {
+    std::vector<Ray> rays;
+    rays.reserve(64 * 64);
+
+    glm::vec3 origin(-1.0f, 0.5f, 0.5f);
+    for (int i = 0; i < 64; i++) {
+        for (int j = 0; j < 64; j++) {
+            glm::vec3 target(1.0f, (j + 0.5f) / 64.0f, (i + 0.5f) / 64.0f);
+            rays.push_back(Ray{origin, glm::normalize(target - origin)});
+        }
+    }
+
+    return rays;
+}
+} // namespace
+
+TEST_CASE("SvoDag benchmarks", "[benchmark]") {
+    size_t depth = GENERATE(range<size_t>(6, 12));
+    std::string content = GENERATE(from_range(contents));
+
+    std::vector<Voxel> voxels = generate(content, depth);
+    std::string suffix = std::format("{} depth {}", content, depth);
+
+    record(content, depth, "voxels", voxels.size());
+
+    BENCHMARK_ADVANCED(std::format("insert {}", suffix))
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([&] { return build(voxels, depth); });
+    };
+
+    BENCHMARK_ADVANCED(std::format("dedup {}", suffix))
+    (Catch::Benchmark::Chronometer meter) {
+        std::vector<SvoDag> trees;
+        for (int i = 0; i < meter.runs(); i++) {
+            trees.push_back(build(voxels, depth));
+        }
+
+        meter.measure([&](int i) { trees[i].dedup(); });
+    };
+
+    SvoDag svodag = build(voxels, depth);
+    size_t nodes_before = svodag.serialize().size();
+    svodag.dedup();
+    size_t nodes_after = svodag.serialize().size();
+
+    record(content, depth, "nodes_before_dedup", nodes_before);
+    record(content, depth, "nodes_after_dedup", nodes_after);
+    record(content, depth, "dedup_ratio", double(nodes_before) / nodes_after);
+
+    BENCHMARK(std::format("serialize {}", suffix)) {
+        return svodag.serialize();
+    };
+
+    std::vector<glm::vec3> positions = query_positions();
+    record(content, depth, "lookups_per_iteration", positions.size());
+
+    BENCHMARK(std::format("get {}", suffix)) {
+        uint64_t sum = 0;
+        for (auto& pos : positions) {
+            sum += svodag.get(pos);
+        }
+
+        return sum;
+    };
+
+    BENCHMARK(std::format("query {}", suffix)) {
+        uint64_t sum = 0;
+        for (auto& pos : positions) {
+            sum += svodag.query(pos).at_level;
+        }
+
+        return sum;
+    };
+
+    // A chunk of up to 64^3 from the corner, as streamed to simulations
+    uint32_t chunk = std::min<uint32_t>(1u << depth, 64);
+    VoxelBox box{glm::uvec3(0u), glm::uvec3(chunk)};
+    std::vector<MatID_t> dense(size_t(chunk) * chunk * chunk);
+    record(content, depth, "extracted_voxels", dense.size());
+
+    BENCHMARK(std::format("extract {}", suffix)) {
+        svodag.extract(box, dense);
+        return dense[0];
+    };
+
+    std::vector<Ray> rays = camera_rays();
+    record(content, depth, "rays_per_iteration", rays.size());
+
+    BENCHMARK(std::format("raymarch {}", suffix)) {
+        float hits = 0.0f;
+        for (auto& ray : rays) {
+            hits += raymarch(svodag, ray).a;
+        }
+
+        return hits;
+    };
+
+    std::vector<SerializedNode> nodes = svodag.serialize();
+    uint32_t level = svodag.get_level();
+
+    BENCHMARK(std::format("raymarch flat {}", suffix)) {
+        uint64_t steps = 0;
+        for (auto& ray : rays) {
+            steps += trace_flat(nodes, level, ray).steps;
+        }
+
+        return steps;
+    };
+
+    // camera_rays() are row by row, so each packet holds four neighbours
+    BENCHMARK(std::format("raymarch packets {}", suffix)) {
+        uint64_t steps = 0;
+        for (size_t i = 0; i < rays.size(); i += packet_size) {
+            auto results = trace_flat_packet(
+                nodes, level,
+                std::span<const Ray, packet_size>(&rays[i], packet_size)
+            );
+
+            for (auto& result : results) {
+                steps += result.steps;
+            }
+        }
+
+        return steps;
+    };
+}
@@ -1,8 +1,10 @@
 #define CATCH_CONFIG_MAIN
 
+#include <catch2/catch_approx.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/generators/catch_generators_random.hpp>
 #include <format>
+#include <functional>
 #include <utility>
 #include <string>
 #include <random>
@@ -10,6 +12,14 @@
 #include "include/common.hpp"
 #include "include/renderer.hpp"
 #include "include/svodag.hpp"
+#include "include/bvh.hpp"
+#include "include/environment.hpp"
+#include "include/mip_chain.hpp"
+#include "include/program.hpp"
+#include "include/benchmark.hpp"
+#include "include/cpu_raymarch.hpp"
+#include "include/raycast.hpp"
+#include "include/mesher.hpp"
 #include "include/formatter.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -17,6 +27,32 @@
 
 #define F std::format
 
+namespace {
+// A sphere of radius 10 in the middle of a deduplicated tree of level 5, with
+// the materials of `mat_id`. `floor` adds a slab two voxels thick under it.
+SvoDag sphere_tree(
+    std::function<MatID_t(size_t, size_t, size_t)> mat_id, bool floor = false
+) {
+    SvoDag svodag{5};
+
+    for (size_t x = 0; x < 32; x++) {
+        for (size_t y = 0; y < 32; y++) {
+            for (size_t z = 0; z < 32; z++) {
+                size_t length = (x - 16) * (x - 16) + (y - 16) * (y - 16) +
+                                (z - 16) * (z - 16);
+                if (length < 100 || (floor && y < 2)) {
+                    svodag.insert(x, y, z, mat_id(x, y, z));
+                }
+            }
+        }
+    }
+
+    svodag.dedup();
+
+    return svodag;
+}
+} // namespace
+
 // template <class... Args>
 // constexpr std::string f(std::format_string<Args...> fmt, Args&&... args) {
 // 	return (std::format(std::move(fmt), std::forward<Args&&>(args)...));
@@ -164,3 +200,777 @@ TEST_CASE("Svodag solidification", "[svodag]") {
     REQUIRE(data.size() == 1);
     REQUIRE(data[0] == SerializedNode{1, {0, 0, 0, 0, 0, 0, 0, 0}});
 }
+
+TEST_CASE("Svodag occupancy serialization", "[svodag]") {
+    const size_t level = 5;
+    MatID_t id = 1;
+    SvoDag svodag =
+        sphere_tree([&](size_t, size_t, size_t) { return id++ % 4 + 1; });
+
+    std::vector<OccupancyNode> occupancy(svodag.serialize_occupancy());
+
+    // Same walk as raymarch_model_occupancy() in common.comp
+    auto occupied = [&](size_t x, size_t y, size_t z) {
+        auto child_index = [&](size_t j) {
+            return (((x >> (j - 1)) & 1) << 2) | (((y >> (j - 1)) & 1) << 1) |
+                   ((z >> (j - 1)) & 1);
+        };
+
+        Addr_t node = 0;
+        for (size_t j = level; j >= 1; j--) {
+            Addr_t child = occupancy[node].child[child_index(j)];
+
+            if (child == occupancy_solid || child == occupancy_empty) {
+                return child == occupancy_solid;
+            }
+
+            if (child & occupancy_brick) {
+                return ((child >> child_index(j - 1)) & 1) != 0;
+            }
+
+            node = child;
+        }
+
+        return false;
+    };
+
+    for (size_t x = 0; x < 32; x++) {
+        for (size_t y = 0; y < 32; y++) {
+            for (size_t z = 0; z < 32; z++) {
+                REQUIRE(occupied(x, y, z) == (svodag.get(x, y, z) != 0));
+            }
+        }
+    }
+
+    // Materials are gone, so the sphere has far fewer unique subtrees
+    REQUIRE(occupancy.size() < svodag.serialize().size());
+}
+
+TEST_CASE("Instance BVH build and refit", "[bvh]") {
+    std::vector<Aabb> bounds;
+    for (int i = 0; i < 100; i++) {
+        glm::vec3 pos(float(i % 10) * 3.0f, float(i / 10) * 3.0f, 0.0f);
+        bounds.push_back(Aabb{pos, pos + glm::vec3(1.0f)});
+    }
+
+    InstanceBvh bvh;
+    REQUIRE(bvh.update(bounds));
+    REQUIRE_FALSE(bvh.update(bounds));
+
+    auto check = [&]() {
+        const auto& nodes = bvh.get_nodes();
+        std::vector<int> seen(bounds.size(), 0);
+
+        for (auto& node : nodes) {
+            Aabb box{node.aabb_min, node.aabb_max};
+
+            if (node.count == 0) {
+                REQUIRE(box.contains(Aabb{
+                    nodes[node.left_first].aabb_min,
+                    nodes[node.left_first].aabb_max
+                }));
+                REQUIRE(box.contains(Aabb{
+                    nodes[node.left_first + 1].aabb_min,
+                    nodes[node.left_first + 1].aabb_max
+                }));
+                continue;
+            }
+
+            for (uint32_t i = node.left_first; i < node.left_first + node.count;
+                 i++) {
+                uint32_t prim = bvh.get_indices()[i];
+                seen[prim]++;
+                REQUIRE(box.contains(bounds[prim]));
+            }
+        }
+
+        for (auto count : seen) {
+            REQUIRE(count == 1);
+        }
+    };
+
+    check();
+
+    for (auto& box : bounds) {
+        box.min.z += 0.5f;
+        box.max.z += 0.5f;
+    }
+
+    REQUIRE(bvh.update(bounds));
+    check();
+}
+
+TEST_CASE("Environment alias table", "[environment]") {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(0.0f, 10.0f);
+
+    std::vector<float> weights(1000);
+    for (auto& weight : weights) {
+        weight = dist(rng);
+    }
+    weights[3] = 0.0f;
+    weights[500] = 5000.0f;
+
+    std::vector<AliasEntry> table = build_alias_table(weights);
+    REQUIRE(table.size() == weights.size());
+
+    float sum = 0.0f;
+    for (auto weight : weights) {
+        sum += weight;
+    }
+
+    // Chance of each texel implied by the thresholds and aliases
+    std::vector<double> implied(table.size(), 0.0);
+    for (size_t i = 0; i < table.size(); i++) {
+        REQUIRE(table[i].threshold >= 0.0f);
+        REQUIRE(table[i].threshold <= 1.0f);
+
+        implied[i] += table[i].threshold / double(table.size());
+        implied[table[i].alias] +=
+            (1.0 - table[i].threshold) / double(table.size());
+    }
+
+    for (size_t i = 0; i < table.size(); i++) {
+        REQUIRE(std::abs(implied[i] - weights[i] / sum) < 1e-5);
+        REQUIRE(std::abs(table[i].probability - weights[i] / sum) < 1e-5);
+    }
+}
+
+TEST_CASE("Mip chains average in linear space", "[texture]") {
+    // Black and white checkerboard
+    std::vector<std::byte> image(4 * 4 * 4);
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            std::byte value = (x + y) % 2 ? std::byte{255} : std::byte{0};
+            for (int c = 0; c < 3; c++) {
+                image[(y * 4 + x) * 4 + c] = value;
+            }
+            image[(y * 4 + x) * 4 + 3] = std::byte{255};
+        }
+    }
+
+    MipChain chain = MipChain::build(image, 4, 4);
+
+    REQUIRE(chain.get_levels() == 3);
+    REQUIRE(chain.get_width(2) == 1);
+    REQUIRE(std::ranges::equal(chain.level(0), image));
+
+    // Half the light is 188 in sRGB, not 128
+    for (int level = 1; level < chain.get_levels(); level++) {
+        auto texels = chain.level(level);
+        REQUIRE(
+            texels.size() ==
+            size_t(chain.get_width(level) * chain.get_height(level) * 4)
+        );
+
+        for (size_t i = 0; i < texels.size(); i += 4) {
+            REQUIRE(int(texels[i]) == 188);
+            REQUIRE(int(texels[i + 3]) == 255);
+        }
+    }
+}
+
+TEST_CASE("Shader defines follow #version", "[shader]") {
+    auto path = std::filesystem::temp_directory_path() / "defines_test.comp";
+    std::ofstream(path) << "#version 450 core\nvoid main() {}\n";
+
+    std::string source =
+        preprocess_shader(path, {{"SPECIALIZED", ""}, {"D_POS", "false"}});
+
+    REQUIRE(
+        source == "#version 450 core\n#define SPECIALIZED \n"
+                  "#define D_POS false\n#line 2 0\nvoid main() {}\n"
+    );
+    REQUIRE(preprocess_shader(path) == "#version 450 core\nvoid main() {}\n");
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Camera paths interpolate and hold their ends", "[benchmark]") {
+    CameraPath path({
+        CameraKey{1.0f, glm::vec3(2.0f, 0.0f, 0.0f), 0.0f, 1.0f},
+        CameraKey{0.0f, glm::vec3(0.0f), 0.0f, 0.0f},
+    });
+
+    REQUIRE(path.at(-1.0f).pos == glm::vec3(0.0f));
+    REQUIRE(path.at(0.25f).pos == glm::vec3(0.5f, 0.0f, 0.0f));
+    REQUIRE(path.at(0.25f).yaw == 0.25f);
+    REQUIRE(path.at(2.0f).pos == glm::vec3(2.0f, 0.0f, 0.0f));
+
+    char* args[] = {
+        (char*)"voxel-engine", (char*)"--headless", (char*)"--frames",
+        (char*)"10"
+    };
+    BenchmarkOptions options = parse_options(args);
+    REQUIRE(options.headless);
+    REQUIRE(options.frames == 10);
+
+    char* bad_args[] = {(char*)"voxel-engine", (char*)"--frames"};
+    REQUIRE_THROWS(parse_options(bad_args));
+}
+
+TEST_CASE("Flat traversal agrees with the tree", "[svodag]") {
+    const uint32_t level = 5;
+    SvoDag svodag = sphere_tree([](size_t x, size_t y, size_t z) {
+        return MatID_t((x + y + z) % 3 + 1);
+    });
+    std::vector<SerializedNode> nodes = svodag.serialize();
+
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+
+    size_t hits = 0;
+    for (int i = 0; i < 256; i++) {
+        glm::vec3 origin =
+            glm::vec3(0.5f) + 2.0f * glm::normalize(glm::vec3(
+                                         dis(gen), dis(gen), dis(gen)
+                                     ));
+        glm::vec3 target =
+            glm::vec3(0.5f) + 0.2f * glm::vec3(dis(gen), dis(gen), dis(gen));
+        Ray ray{origin, glm::normalize(target - origin)};
+
+        FlatTraceResult result = trace_flat(nodes, level, ray);
+
+        // Every ray ends inside the sphere, which has radius 10 / 32
+        REQUIRE(result.hit);
+        REQUIRE(result.steps <= flat_max_iters);
+        REQUIRE(svodag.get(result.pos) == result.mat_id);
+        REQUIRE(glm::length(result.normal) >= 1.0f); // sqrt(2) on edges
+
+        hits += trace(svodag, ray).has_value();
+    }
+
+    REQUIRE(hits == 256);
+
+    Ray miss{glm::vec3(-1.0f, 2.0f, 0.5f), glm::vec3(1.0f, 0.0f, 0.0f)};
+    REQUIRE_FALSE(trace_flat(nodes, level, miss).hit);
+
+    // Along an axis and on voxel faces, where slab_test() meets 0 * inf
+    Ray along{glm::vec3(0.5f, 2.0f, 0.5f), glm::vec3(0.0f, -1.0f, 0.0f)};
+    FlatTraceResult result = trace_flat(nodes, level, along);
+    REQUIRE(result.hit);
+    REQUIRE(svodag.get(result.pos) == result.mat_id);
+}
+
+TEST_CASE("Occupancy traversal agrees with the tree", "[svodag]") {
+    const uint32_t level = 5;
+    SvoDag svodag = sphere_tree([](size_t x, size_t y, size_t z) {
+        return MatID_t((x + y + z) % 3 + 1);
+    });
+    std::vector<SerializedNode> nodes = svodag.serialize();
+    std::vector<OccupancyNode> occupancy = svodag.serialize_occupancy();
+
+    std::mt19937 gen(4);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+
+    // Half of the targets lie outside the sphere, so some rays miss
+    size_t hits = 0;
+    for (int i = 0; i < 512; i++) {
+        glm::vec3 origin =
+            glm::vec3(0.5f) + 2.0f * glm::normalize(glm::vec3(
+                                         dis(gen), dis(gen), dis(gen)
+                                     ));
+        glm::vec3 target =
+            glm::vec3(0.5f) + 0.5f * glm::vec3(dis(gen), dis(gen), dis(gen));
+        Ray ray{origin, glm::normalize(target - origin)};
+
+        bool hit = trace_occupancy(occupancy, level, ray);
+        REQUIRE(hit == trace_flat(nodes, level, ray).hit);
+
+        hits += hit;
+    }
+
+    REQUIRE(hits > 0);
+    REQUIRE(hits < 512);
+
+    // Shadow rays start inside the model, here in the hollow of a box
+    SvoDag box{level};
+    for (size_t x = 0; x < 32; x++) {
+        for (size_t y = 0; y < 32; y++) {
+            for (size_t z = 0; z < 32; z++) {
+                bool wall = x < 2 || y < 2 || z < 2 || x > 29 || y > 29 ||
+                            z > 29;
+                if (wall) {
+                    box.insert(x, y, z, 1);
+                }
+            }
+        }
+    }
+
+    box.dedup();
+    occupancy = box.serialize_occupancy();
+
+    for (int i = 0; i < 64; i++) {
+        glm::vec3 dir =
+            glm::normalize(glm::vec3(dis(gen), dis(gen), dis(gen)));
+        REQUIRE(trace_occupancy(occupancy, level, Ray{glm::vec3(0.5f), dir}));
+    }
+}
+
+TEST_CASE("Ray packets trace like single rays", "[svodag]") {
+    const uint32_t level = 5;
+    SvoDag svodag = sphere_tree(
+        [](size_t x, size_t y, size_t z) {
+            return MatID_t((x + y + z) % 3 + 1);
+        },
+        true
+    );
+    std::vector<SerializedNode> nodes = svodag.serialize();
+
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+
+    for (int i = 0; i < 512; i++) {
+        glm::vec3 origin =
+            glm::vec3(0.5f) + 1.5f * glm::normalize(glm::vec3(
+                                         dis(gen), dis(gen), dis(gen)
+                                     ));
+        glm::vec3 target =
+            glm::vec3(0.5f) + 0.4f * glm::vec3(dis(gen), dis(gen), dis(gen));
+
+        // Neighbours that stay together, then rays that part at once
+        float spread = i % 2 ? 0.002f : 0.5f;
+
+        std::array<Ray, packet_size> rays;
+        for (auto& ray : rays) {
+            glm::vec3 end =
+                target + spread * glm::vec3(dis(gen), dis(gen), dis(gen));
+            ray = Ray{origin, glm::normalize(end - origin)};
+        }
+
+        // Misses the model
+        if (i % 4 == 0) {
+            rays[1].dir = glm::normalize(glm::vec3(0.5f) - origin) * -1.0f;
+        }
+
+        // Axis aligned, from the middle of a voxel face
+        if (i % 8 == 0) {
+            rays[2] = Ray{
+                glm::vec3(0.5f, 0.5f, -1.0f), glm::vec3(0.0f, 0.0f, 1.0f)
+            };
+        }
+
+        auto results = trace_flat_packet(nodes, level, rays);
+
+        for (size_t r = 0; r < packet_size; r++) {
+            FlatTraceResult single = trace_flat(nodes, level, rays[r]);
+
+            REQUIRE(results[r].hit == single.hit);
+            REQUIRE(results[r].steps == single.steps);
+
+            if (single.hit) {
+                REQUIRE(results[r].pos == single.pos);
+                REQUIRE(results[r].normal == single.normal);
+                REQUIRE(results[r].at_level == single.at_level);
+                REQUIRE(results[r].mat_id == single.mat_id);
+            }
+        }
+    }
+
+    // Through the middle of the sphere
+    Ray ray{glm::vec3(0.5f, 0.5f, -1.0f), glm::vec3(0.0f, 0.0f, 1.0f)};
+    REQUIRE(trace_flat(nodes, level, ray).hit);
+}
+
+TEST_CASE("Threaded CPU renders match single rays", "[svodag]") {
+    const uint32_t level = 5;
+    SvoDag svodag = sphere_tree([](size_t x, size_t y, size_t z) {
+        return MatID_t((x + y + z) % 3 + 1);
+    });
+    std::vector<SerializedNode> nodes = svodag.serialize();
+
+    // The same tree twice, overlapping on screen
+    std::array<CpuInstance, 2> instances = {
+        CpuInstance{&svodag, glm::mat4(1.0f)},
+        CpuInstance{
+            &svodag,
+            glm::scale(
+                glm::translate(glm::mat4(1.0f), glm::vec3(0.3f, 0.2f, 0.8f)),
+                glm::vec3(0.7f)
+            )
+        }
+    };
+
+    CpuCamera camera{
+        glm::vec3(0.6f, 0.5f, -1.5f), glm::vec3(0.0f, 0.0f, 1.0f),
+        glm::vec3(0.5f, 0.0f, 0.0f), glm::vec3(0.0f, 0.4f, 0.0f)
+    };
+
+    // Odd sizes leave partial tiles and packets at the edges
+    const int width = 45;
+    const int height = 37;
+    std::vector<std::array<std::byte, 4>> image(width * height);
+
+    ThreadPool pool(4);
+    render_cpu(camera, instances, width, height, image, pool, 8);
+
+    size_t hits = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            glm::vec2 frag(
+                (x + 0.5f) / width * 2.0f - 1.0f,
+                1.0f - (y + 0.5f) / height * 2.0f
+            );
+            glm::vec3 dir = glm::normalize(
+                camera.dir + frag.x * camera.right + frag.y * camera.up
+            );
+
+            bool hit = false;
+            for (auto& instance : instances) {
+                glm::mat4 inv = glm::inverse(instance.transform);
+                Ray ray{
+                    inv * glm::vec4(camera.pos, 1.0f),
+                    glm::normalize(glm::vec3(inv * glm::vec4(dir, 0.0f)))
+                };
+
+                hit = hit || trace_flat(nodes, level, ray).hit;
+            }
+
+            // Hits are white for now, like raymarch()
+            std::byte expected = hit ? std::byte(255) : std::byte(0);
+            for (std::byte c : image[y * width + x]) {
+                REQUIRE(c == expected);
+            }
+
+            hits += hit;
+        }
+    }
+
+    REQUIRE(hits > 0);
+    REQUIRE(hits < size_t(width * height));
+}
+
+TEST_CASE("Batched ray casts find the nearest instance", "[raycast]") {
+    const uint32_t level = 5;
+    SvoDag svodag = sphere_tree([](size_t, size_t, size_t) { return 1; });
+    std::vector<SerializedNode> nodes = svodag.serialize();
+
+    // A grid of parallel rays along +x, through the middle of the model
+    std::vector<Ray> rays;
+    for (int i = 0; i < 64; i++) {
+        for (int j = 0; j < 64; j++) {
+            rays.push_back(Ray{
+                glm::vec3(-1.0f, (i + 0.5f) / 64.0f, (j + 0.5f) / 64.0f),
+                glm::vec3(1.0f, 0.0f, 0.0f)
+            });
+        }
+    }
+
+    ThreadPool pool(4);
+
+    std::vector<RayHit> hits(rays.size());
+    raycast_batch(svodag, rays, hits, &pool);
+
+    for (size_t i = 0; i < rays.size(); i++) {
+        FlatTraceResult single = trace_flat(nodes, level, rays[i]);
+
+        REQUIRE(hits[i].hit == single.hit);
+        if (single.hit) {
+            REQUIRE(hits[i].pos == single.pos);
+            REQUIRE(hits[i].normal == glm::vec3(-1.0f, 0.0f, 0.0f));
+            REQUIRE(hits[i].distance == Catch::Approx(single.pos.x + 1.0f));
+        }
+    }
+
+    // The same model twice along the rays, the far one twice as large
+    entt::registry registry;
+    entt::entity near_entity = registry.create();
+    entt::entity far_entity = registry.create();
+
+    glm::mat4 near_transform(1.0f);
+    near_transform[3] = glm::vec4(2.0f, 0.0f, 0.0f, 1.0f);
+    glm::mat4 far_transform(2.0f);
+    far_transform[3] = glm::vec4(5.0f, -0.5f, -0.5f, 1.0f);
+
+    std::vector<RaycastInstance> instances = {
+        RaycastInstance{nodes, level, far_transform, far_entity},
+        RaycastInstance{nodes, level, near_transform, near_entity},
+    };
+
+    std::vector<SceneHit> scene_hits(rays.size());
+    raycast_scene(instances, rays, scene_hits, &pool);
+
+    size_t near_hits = 0;
+    size_t far_hits = 0;
+    for (size_t i = 0; i < rays.size(); i++) {
+        if (!scene_hits[i].hit) {
+            REQUIRE(scene_hits[i].entity == entt::entity(entt::null));
+            continue;
+        }
+
+        if (scene_hits[i].entity == near_entity) {
+            near_hits++;
+            REQUIRE(hits[i].hit);
+            REQUIRE(scene_hits[i].pos.x == Catch::Approx(hits[i].pos.x + 2.0f));
+        } else {
+            far_hits++;
+            REQUIRE_FALSE(hits[i].hit);
+            REQUIRE(scene_hits[i].entity == far_entity);
+            REQUIRE(scene_hits[i].pos.x >= 5.0f);
+        }
+    }
+
+    // Everything the near sphere misses, the larger far one catches around
+    REQUIRE(near_hits > 0);
+    REQUIRE(far_hits > 0);
+
+    std::vector<SceneHit> unthreaded(rays.size());
+    raycast_scene(instances, rays, unthreaded);
+    for (size_t i = 0; i < rays.size(); i++) {
+        REQUIRE(unthreaded[i].hit == scene_hits[i].hit);
+        REQUIRE(unthreaded[i].distance == scene_hits[i].distance);
+    }
+}
+
+TEST_CASE("Box queries agree with voxel lookups", "[svodag]") {
+    const size_t level = 4;
+    const size_t size = 1 << level;
+    SvoDag svodag{level};
+
+    // A floor four voxels deep, which dedups into large uniform nodes, and a
+    // small block of another material above it
+    for (size_t x = 0; x < size; x++) {
+        for (size_t z = 0; z < size; z++) {
+            for (size_t y = 0; y < 4; y++) {
+                svodag.insert(x, y, z, 1);
+            }
+        }
+    }
+    for (size_t x = 11; x < 14; x++) {
+        for (size_t y = 8; y < 11; y++) {
+            for (size_t z = 11; z < 14; z++) {
+                svodag.insert(x, y, z, 2);
+            }
+        }
+    }
+
+    svodag.dedup();
+
+    auto voxel = [&](size_t x, size_t y, size_t z) {
+        glm::vec3 min = glm::vec3(x, y, z) / float(size);
+        return Aabb{min, min + glm::vec3(1.0f / size)};
+    };
+
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<float> dis(-0.2f, 1.2f);
+    std::uniform_real_distribution<float> extent(0.0f, 0.3f);
+
+    for (int i = 0; i < 200; i++) {
+        glm::vec3 min(dis(gen), dis(gen), dis(gen));
+        Aabb box{min, min + glm::vec3(extent(gen), extent(gen), extent(gen))};
+
+        size_t solid = 0;
+        for (size_t x = 0; x < size; x++) {
+            for (size_t y = 0; y < size; y++) {
+                for (size_t z = 0; z < size; z++) {
+                    solid += voxel(x, y, z).overlaps(box) &&
+                             svodag.get(x, y, z) != 0;
+                }
+            }
+        }
+
+        REQUIRE(svodag.overlaps(box) == (solid > 0));
+
+        // Coarse cells stand for every voxel inside them
+        std::vector<SolidCell> cells;
+        svodag.collect_solid(box, cells);
+
+        size_t covered = 0;
+        for (auto& cell : cells) {
+            REQUIRE(cell.bounds.overlaps(box));
+            REQUIRE(svodag.get(cell.bounds.centroid()) == cell.mat_id);
+
+            glm::vec3 first = cell.bounds.min * float(size);
+            glm::vec3 last = cell.bounds.max * float(size);
+            for (size_t x = first.x; x < last.x; x++) {
+                for (size_t y = first.y; y < last.y; y++) {
+                    for (size_t z = first.z; z < last.z; z++) {
+                        covered += voxel(x, y, z).overlaps(box);
+                    }
+                }
+            }
+        }
+
+        REQUIRE(covered == solid);
+
+        // Free right before the time of impact and blocked right after it
+        glm::vec3 velocity(dis(gen), dis(gen), dis(gen));
+        SweepResult result = svodag.sweep(box, velocity);
+        auto moved = [&](float t) {
+            return Aabb{box.min + velocity * t, box.max + velocity * t};
+        };
+
+        REQUIRE(result.t >= 0.0f);
+        REQUIRE(result.t <= 1.0f);
+        if (result.t > 0.0f) {
+            REQUIRE_FALSE(svodag.overlaps(moved(result.t * 0.999f)));
+        }
+        if (result.t < 1.0f) {
+            REQUIRE(svodag.overlaps(moved(result.t + 1e-4f)));
+            REQUIRE(result.mat_id != 0);
+        } else {
+            REQUIRE(result.mat_id == 0);
+        }
+    }
+
+    // Falling onto the floor, whose top is at y = 0.25
+    Aabb falling{glm::vec3(0.4f, 0.6f, 0.4f), glm::vec3(0.5f, 0.7f, 0.5f)};
+    SweepResult landed = svodag.sweep(falling, glm::vec3(0.0f, -0.5f, 0.0f));
+
+    REQUIRE(landed.t == Catch::Approx(0.7f));
+    REQUIRE(landed.normal == glm::vec3(0.0f, 1.0f, 0.0f));
+    REQUIRE(landed.mat_id == 1);
+
+    // Resting on the floor is not overlapping it, and leaves it freely
+    Aabb resting{glm::vec3(0.4f, 0.25f, 0.4f), glm::vec3(0.5f, 0.35f, 0.5f)};
+    REQUIRE_FALSE(svodag.overlaps(resting));
+    REQUIRE(svodag.sweep(resting, glm::vec3(0.0f, 0.5f, 0.0f)).t == 1.0f);
+    REQUIRE(svodag.sweep(resting, glm::vec3(0.0f, -0.5f, 0.0f)).t == 0.0f);
+}
+
+TEST_CASE("Extraction agrees with voxel lookups", "[svodag]") {
+    const size_t level = 6;
+    SvoDag svodag{level};
+
+    // Repeated 4^3 patterns that dedup into shared subtrees, over a solid
+    // half that solidifies into large uniform nodes
+    for (size_t x = 0; x < 64; x++) {
+        for (size_t y = 0; y < 64; y++) {
+            for (size_t z = 0; z < 64; z++) {
+                if (y < 32) {
+                    svodag.insert(x, y, z, 1);
+                } else if ((x % 4 + y % 4 + z % 4) % 3 == 0) {
+                    svodag.insert(x, y, z, 2 + (x % 4 == 0));
+                }
+            }
+        }
+    }
+
+    svodag.dedup();
+
+    ThreadPool pool(4);
+    std::vector<VoxelBox> boxes = {
+        VoxelBox{glm::uvec3(0u), glm::uvec3(64u)},
+        VoxelBox{glm::uvec3(3u, 20u, 7u), glm::uvec3(61u, 50u, 40u)},
+        VoxelBox{glm::uvec3(33u, 33u, 33u), glm::uvec3(37u, 45u, 39u)},
+        VoxelBox{glm::uvec3(50u, 10u, 60u), glm::uvec3(70u, 80u, 66u)},
+        VoxelBox{glm::uvec3(5u), glm::uvec3(5u)},
+    };
+
+    for (auto& box : boxes) {
+        glm::uvec3 size = box.max - box.min;
+        std::vector<MatID_t> out(size_t(size.x) * size.y * size.z);
+        std::vector<MatID_t> threaded(out.size());
+
+        svodag.extract(box, out);
+        svodag.extract(box, threaded, &pool);
+        REQUIRE(out == threaded);
+
+        size_t i = 0;
+        size_t mismatches = 0;
+        for (uint32_t z = box.min.z; z < box.max.z; z++) {
+            for (uint32_t y = box.min.y; y < box.max.y; y++) {
+                for (uint32_t x = box.min.x; x < box.max.x; x++, i++) {
+                    bool inside = x < 64 && y < 64 && z < 64;
+                    mismatches += out[i] != (inside ? svodag.get(x, y, z) : 0);
+                }
+            }
+        }
+
+        REQUIRE(mismatches == 0);
+    }
+
+    std::vector<MatID_t> wrong(10);
+    REQUIRE_THROWS(svodag.extract(boxes[0], wrong));
+}
+
+TEST_CASE("Greedy meshes cover exactly the exposed faces", "[mesher]") {
+    const size_t level = 7;
+    const int size = 1 << level;
+    SvoDag svodag{level};
+
+    // The same pillars in every chunk over a flat floor, so that most chunks
+    // share their mesh
+    for (int x = 0; x < size; x++) {
+        for (int z = 0; z < size; z++) {
+            for (int y = 0; y < 40; y++) {
+                bool pillar = x % 8 < 2 && z % 8 < 3 && y < 20 + x % 32 / 8;
+                if (y < 16 || pillar) {
+                    svodag.insert(x, y, z, y < 16 ? 1 : 2);
+                }
+            }
+        }
+    }
+
+    svodag.dedup();
+
+    auto solid = [&](glm::ivec3 p) -> MatID_t {
+        for (int i = 0; i < 3; i++) {
+            if (p[i] < 0 || p[i] >= size) {
+                return 0;
+            }
+        }
+
+        return svodag.get(p.x, p.y, p.z);
+    };
+
+    // Every exposed face is covered once by a quad of its material
+    const std::array<glm::ivec3, 6> steps = {
+        glm::ivec3(-1, 0, 0), glm::ivec3(1, 0, 0),  glm::ivec3(0, -1, 0),
+        glm::ivec3(0, 1, 0),  glm::ivec3(0, 0, -1), glm::ivec3(0, 0, 1)
+    };
+
+    ThreadPool pool(4);
+    std::vector<MeshQuad> quads = mesh_greedy(svodag, &pool);
+    std::vector<uint8_t> covered(size_t(6) * size * size * size);
+    size_t mismatches = 0;
+
+    for (auto& quad : quads) {
+        int axis = quad.face / 2;
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+
+        for (uint32_t j = 0; j < quad.height; j++) {
+            for (uint32_t i = 0; i < quad.width; i++) {
+                glm::ivec3 p(quad.origin[0], quad.origin[1], quad.origin[2]);
+                p[u] += i;
+                p[v] += j;
+                // The voxel the face belongs to
+                p[axis] -= quad.face % 2;
+
+                mismatches += solid(p) != quad.mat_id ||
+                              solid(p + steps[quad.face]) != 0;
+
+                size_t index = ((size_t(quad.face) * size + p.z) * size + p.y) *
+                                   size + p.x;
+                covered[index]++;
+            }
+        }
+    }
+
+    REQUIRE(mismatches == 0);
+
+    size_t exposed = 0;
+    for (int face = 0; face < 6; face++) {
+        for (int z = 0; z < size; z++) {
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    glm::ivec3 p(x, y, z);
+                    bool face_exposed =
+                        solid(p) != 0 && solid(p + steps[face]) == 0;
+                    size_t index =
+                        ((size_t(face) * size + z) * size + y) * size + x;
+
+                    exposed += face_exposed;
+                    mismatches += covered[index] != (face_exposed ? 1 : 0);
+                }
+            }
+        }
+    }
+
+    REQUIRE(mismatches == 0);
+
+    // Greedy merging makes a few quads out of the flat floor
+    REQUIRE(quads.size() * 4 < exposed);
+    REQUIRE(mesh_greedy(svodag).size() == quads.size());
+}